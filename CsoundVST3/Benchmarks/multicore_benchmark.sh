@@ -0,0 +1,19 @@
+#!/bin/bash
+# Renders multicore_benchmark.csd with 1 to N threads, where N defaults to
+# the number of CPUs, and prints the render time and speedup for each.
+set -euo pipefail
+
+csd="$(dirname "$0")/multicore_benchmark.csd"
+maximum_threads=${1:-$(getconf _NPROCESSORS_ONLN)}
+
+printf "%8s %12s %8s\n" "Threads" "Seconds" "Speedup"
+for ((threads = 1; threads <= maximum_threads; threads++)); do
+    begin=$(date +%s.%N)
+    csound -j "$threads" "$csd" > /dev/null 2>&1
+    end=$(date +%s.%N)
+    seconds=$(echo "$end - $begin" | bc -l)
+    if ((threads == 1)); then
+        baseline=$seconds
+    fi
+    printf "%8d %12.3f %8.2f\n" "$threads" "$seconds" "$(echo "$baseline / $seconds" | bc -l)"
+done
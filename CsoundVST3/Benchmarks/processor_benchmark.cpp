@@ -0,0 +1,307 @@
+/**
+ * Drives CsoundVST3AudioProcessor without a host or GUI, as a host would:
+ * prepares it, then calls processBlock with a play head and synthetic MIDI
+ * notes, timing each block. Reports, as JSON, for each combination of
+ * block size and sample rate: percentiles of the time per block, the real
+ * time factor (seconds of audio rendered per second of processing), the
+ * blocks that missed their deadline (took longer than they last), and the
+ * C++ heap allocations made during processBlock.
+ *
+ * Usage: CsoundVST3_Bench [options]
+ *
+ *     --csd file             default Resources/Examples/CsoundVST3.csd
+ *     --block sizes          comma-separated, default 128,512
+ *     --rate rates           comma-separated, default 48000
+ *     --inputs channels      default 2
+ *     --outputs channels     default 2
+ *     --seconds seconds      measured audio per run, default 10
+ *     --warmup seconds       unmeasured audio per run, default 1
+ *     --notes rate           MIDI notes per second, default 8
+ *     --note-seconds length  of each MIDI note, default 0.5
+ *     --threads count        Csound threads, default 0 (automatic)
+ *     --shared-render-pool   render on the shared render threads
+ *     --verbose              print Csound's messages to stderr
+ *     --output file          write the JSON here, not to stdout
+ */
+#include "ProcessorHarness.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+
+#ifndef CSOUNDVST3_EXAMPLES_DIRECTORY
+#define CSOUNDVST3_EXAMPLES_DIRECTORY "Resources/Examples"
+#endif
+
+/**
+ * Counts calls to the global operator new, on every thread. Allocations by
+ * Csound itself, which is written in C, are not counted.
+ */
+static std::atomic<int64_t> allocation_count {0};
+
+void *operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (auto pointer = std::malloc(size == 0 ? 1 : size))
+    {
+        return pointer;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::size_t) noexcept
+{
+    std::free(pointer);
+}
+
+/**
+ * A transport that is always playing, from frame 0.
+ */
+class BenchmarkPlayHead : public juce::AudioPlayHead
+{
+public:
+    juce::Optional<PositionInfo> getPosition() const override
+    {
+        PositionInfo position;
+        position.setTimeInSamples(frame);
+        position.setTimeInSeconds(double(frame) / sample_rate);
+        position.setIsPlaying(true);
+        return position;
+    }
+    double sample_rate = 48000;
+    int64_t frame = 0;
+};
+
+/**
+ * Plays random notes on MIDI channel 1 at a steady average rate, each for
+ * the same length, without allocating.
+ */
+class NoteGenerator
+{
+public:
+    NoteGenerator(double notes_per_second_, double note_seconds_)
+        : notes_per_second(notes_per_second_), note_seconds(note_seconds_)
+    {
+        pending.reserve(1024);
+    }
+    void addBlock(juce::MidiBuffer &midi, int64_t block_frame, int block_size, double sample_rate)
+    {
+        auto block_end = block_frame + block_size;
+        for (size_t index = 0; index < pending.size(); )
+        {
+            if (pending[index].first < block_end)
+            {
+                midi.addEvent(juce::MidiMessage::noteOff(1, pending[index].second), int(std::max<int64_t>(0, pending[index].first - block_frame)));
+                pending[index] = pending.back();
+                pending.pop_back();
+            }
+            else
+            {
+                ++index;
+            }
+        }
+        due_notes += notes_per_second * block_size / sample_rate;
+        std::uniform_int_distribution<int> offsets(0, block_size - 1);
+        std::uniform_int_distribution<int> keys(36, 96);
+        std::uniform_int_distribution<int> velocities(40, 110);
+        for (; due_notes >= 1. && pending.size() < pending.capacity(); due_notes -= 1.)
+        {
+            auto offset = offsets(random);
+            auto key = keys(random);
+            midi.addEvent(juce::MidiMessage::noteOn(1, key, juce::uint8(velocities(random))), offset);
+            pending.emplace_back(block_frame + offset + int64_t(note_seconds * sample_rate), key);
+        }
+    }
+
+private:
+    double notes_per_second;
+    double note_seconds;
+    double due_notes = 0;
+    std::minstd_rand random {1};
+    /**
+     * The frame at which each sounding note ends, and its key.
+     */
+    std::vector<std::pair<int64_t, int>> pending;
+};
+
+struct Options
+{
+    juce::String csd;
+    juce::String csd_path;
+    int inputs = 2;
+    int outputs = 2;
+    double seconds = 10;
+    double warmup_seconds = 1;
+    double notes_per_second = 8;
+    double note_seconds = 0.5;
+    int threads = 0;
+    bool shared_render_pool = false;
+    bool verbose = false;
+};
+
+/**
+ * Returns the value at the fraction of the sorted values, by nearest rank.
+ */
+static double percentile(const std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+    auto rank = size_t(std::ceil(fraction * double(sorted.size())));
+    return sorted[std::min(sorted.size() - 1, rank == 0 ? 0 : rank - 1)];
+}
+
+static juce::var run(const Options &options, double sample_rate, int block_size)
+{
+    CsoundVST3AudioProcessor processor;
+    processor.csound_thread_count = options.threads;
+    processor.shared_render_pool = options.shared_render_pool;
+    BenchmarkPlayHead play_head;
+    play_head.sample_rate = sample_rate;
+    processor.setPlayHead(&play_head);
+    startProcessor(processor, options.csd, sample_rate, block_size, options.inputs, options.outputs);
+    drainLog(processor, options.verbose);
+    juce::AudioBuffer<float> buffer(std::max(options.inputs, options.outputs), block_size);
+    juce::MidiBuffer midi;
+    midi.ensureSize(8192);
+    NoteGenerator notes(options.notes_per_second, options.note_seconds);
+    auto warmup_blocks = int64_t(options.warmup_seconds * sample_rate / block_size);
+    auto measured_blocks = std::max(int64_t(1), int64_t(options.seconds * sample_rate / block_size));
+    std::vector<double> block_seconds;
+    block_seconds.reserve(size_t(measured_blocks));
+    auto deadline_seconds = block_size / sample_rate;
+    int64_t deadline_misses = 0;
+    int64_t allocations = 0;
+    int64_t blocks_with_allocations = 0;
+    double processing_seconds = 0;
+    auto ticks_per_second = double(juce::Time::getHighResolutionTicksPerSecond());
+    for (int64_t block = 0; block < warmup_blocks + measured_blocks; ++block)
+    {
+        buffer.clear();
+        midi.clear();
+        notes.addBlock(midi, play_head.frame, block_size, sample_rate);
+        auto allocations_begin = allocation_count.load();
+        auto begin = juce::Time::getHighResolutionTicks();
+        processor.processBlock(buffer, midi);
+        auto end = juce::Time::getHighResolutionTicks();
+        auto block_allocations = allocation_count.load() - allocations_begin;
+        play_head.frame += block_size;
+        if (block >= warmup_blocks)
+        {
+            auto seconds = double(end - begin) / ticks_per_second;
+            block_seconds.push_back(seconds);
+            processing_seconds += seconds;
+            deadline_misses += seconds > deadline_seconds;
+            allocations += block_allocations;
+            blocks_with_allocations += block_allocations != 0;
+        }
+        if (block % 64 == 0)
+        {
+            drainLog(processor, options.verbose);
+        }
+    }
+    processor.releaseResources();
+    drainLog(processor, options.verbose);
+    std::sort(block_seconds.begin(), block_seconds.end());
+    auto result = new juce::DynamicObject();
+    result->setProperty("csd", options.csd_path);
+    result->setProperty("sample_rate", sample_rate);
+    result->setProperty("block_size", block_size);
+    result->setProperty("inputs", options.inputs);
+    result->setProperty("outputs", options.outputs);
+    result->setProperty("notes_per_second", options.notes_per_second);
+    result->setProperty("blocks", juce::int64(measured_blocks));
+    result->setProperty("deadline_us", deadline_seconds * 1e6);
+    result->setProperty("block_us_min", block_seconds.front() * 1e6);
+    result->setProperty("block_us_p50", percentile(block_seconds, 0.5) * 1e6);
+    result->setProperty("block_us_p90", percentile(block_seconds, 0.9) * 1e6);
+    result->setProperty("block_us_p99", percentile(block_seconds, 0.99) * 1e6);
+    result->setProperty("block_us_p999", percentile(block_seconds, 0.999) * 1e6);
+    result->setProperty("block_us_max", block_seconds.back() * 1e6);
+    result->setProperty("real_time_factor", double(measured_blocks) * deadline_seconds / processing_seconds);
+    result->setProperty("deadline_misses", juce::int64(deadline_misses));
+    result->setProperty("allocations", juce::int64(allocations));
+    result->setProperty("blocks_with_allocations", juce::int64(blocks_with_allocations));
+    return juce::var(result);
+}
+
+int main(int argc, char **argv)
+{
+    juce::ScopedJuceInitialiser_GUI juce_initialiser;
+    juce::ArgumentList arguments(argc, argv);
+    Options options;
+    auto csd_file = arguments.containsOption("--csd")
+        ? arguments.getFileForOption("--csd")
+        : juce::File(CSOUNDVST3_EXAMPLES_DIRECTORY).getChildFile("CsoundVST3.csd");
+    options.csd_path = csd_file.getFullPathName();
+    options.csd = csd_file.loadFileAsString();
+    if (options.csd.isEmpty())
+    {
+        std::fprintf(stderr, "Could not read %s.\n", options.csd_path.toRawUTF8());
+        return 1;
+    }
+    auto getOption = [&arguments](const juce::String &option, const juce::String &default_value)
+    {
+        auto value = arguments.getValueForOption(option);
+        return value.isEmpty() ? default_value : value;
+    };
+    auto block_sizes = juce::StringArray::fromTokens(getOption("--block", "128,512"), ",", "");
+    auto sample_rates = juce::StringArray::fromTokens(getOption("--rate", "48000"), ",", "");
+    options.inputs = getOption("--inputs", "2").getIntValue();
+    options.outputs = getOption("--outputs", "2").getIntValue();
+    options.seconds = getOption("--seconds", "10").getDoubleValue();
+    options.warmup_seconds = getOption("--warmup", "1").getDoubleValue();
+    options.notes_per_second = getOption("--notes", "8").getDoubleValue();
+    options.note_seconds = getOption("--note-seconds", "0.5").getDoubleValue();
+    options.threads = getOption("--threads", "0").getIntValue();
+    options.shared_render_pool = arguments.containsOption("--shared-render-pool");
+    options.verbose = arguments.containsOption("--verbose");
+    juce::Array<juce::var> runs;
+    for (const auto &sample_rate : sample_rates)
+    {
+        for (const auto &block_size : block_sizes)
+        {
+            runs.add(run(options, sample_rate.getDoubleValue(), block_size.getIntValue()));
+        }
+    }
+    auto json = juce::JSON::toString(juce::var(runs));
+    auto output = arguments.getValueForOption("--output");
+    if (output.isNotEmpty())
+    {
+        if (!juce::File::getCurrentWorkingDirectory().getChildFile(output).replaceWithText(json + "\n"))
+        {
+            std::fprintf(stderr, "Could not write %s.\n", output.toRawUTF8());
+            return 1;
+        }
+    }
+    else
+    {
+        std::printf("%s\n", json.toRawUTF8());
+    }
+    return 0;
+}
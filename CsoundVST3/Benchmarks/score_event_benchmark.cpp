@@ -0,0 +1,118 @@
+/**
+ * Compares the rate at which score events can be sent to Csound 7 as
+ * numbers (csoundEvent) and as formatted text (csoundEventString), as
+ * CsoundThreaded dispatches them. Both paths are warmed up first, then
+ * measured in alternating order for a number of rounds, and the median
+ * rate of each is reported, so that neither is favoured by running second.
+ *
+ * Usage: score_event_benchmark [events] [pfields] [rounds]
+ */
+#include "csound_threaded.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+static const char *orchestra = R"(
+sr = 48000
+ksmps = 128
+nchnls = 2
+0dbfs = 1
+instr 1
+endin
+)";
+
+/**
+ * Sends events in blocks of events_per_kperiod, performing one kperiod
+ * after each block so that Csound consumes them, and returns events per
+ * second.
+ */
+template<typename Send> double measure(CsoundThreaded &csound, long events, long pfield_count, Send send)
+{
+    constexpr long events_per_kperiod = 1000;
+    std::vector<MYFLT> pfields(pfield_count, 0);
+    pfields[0] = 1;
+    auto begin = std::chrono::steady_clock::now();
+    for (long event = 0; event < events; ++event)
+    {
+        // p2 and p3 are 0, so each event runs only its init pass.
+        for (long pfield = 3; pfield < pfield_count; ++pfield)
+        {
+            pfields[pfield] = MYFLT(event % 127) + MYFLT(pfield) / 3.;
+        }
+        send(pfields.data(), pfield_count);
+        if ((event + 1) % events_per_kperiod == 0)
+        {
+            csound.PerformKsmps();
+        }
+    }
+    csound.PerformKsmps();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return events / elapsed.count();
+}
+
+static double median(std::vector<double> rates)
+{
+    std::sort(rates.begin(), rates.end());
+    auto middle = rates.size() / 2;
+    return rates.size() % 2 == 1 ? rates[middle] : (rates[middle - 1] + rates[middle]) / 2.;
+}
+
+int main(int argc, const char **argv)
+{
+#if CSOUND_VERSION_MAJOR >= 7
+    long events = argc > 1 ? std::atol(argv[1]) : 100000;
+    long pfield_count = argc > 2 ? std::max(3L, std::atol(argv[2])) : 8;
+    long rounds = argc > 3 ? std::max(1L, std::atol(argv[3])) : 5;
+    CsoundThreaded csound;
+    csound.SetOption("-n");
+    csound.SetOption("-d");
+    csound.SetOption("-m0");
+    if (csoundCompileOrc(csound.GetCsound(), orchestra, 0) != 0 || csoundStart(csound.GetCsound()) != 0)
+    {
+        std::fprintf(stderr, "Failed to start Csound.\n");
+        return 1;
+    }
+    auto send_text = [&csound](const MYFLT *pfields, long count)
+    {
+        const std::string text = csound_threaded_format_score_event('i', pfields, count);
+        csoundEventString(csound.GetCsound(), text.c_str(), 0);
+    };
+    auto send_numeric = [&csound](const MYFLT *pfields, long count)
+    {
+        csound.ScoreEventImmediate('i', pfields, count);
+    };
+    // Not measured: brings Csound's event and instrument instance pools,
+    // and the caches, to their steady state for both paths.
+    measure(csound, events, pfield_count, send_text);
+    measure(csound, events, pfield_count, send_numeric);
+    std::vector<double> text_rates;
+    std::vector<double> numeric_rates;
+    for (long round = 0; round < rounds; ++round)
+    {
+        if (round % 2 == 0)
+        {
+            text_rates.push_back(measure(csound, events, pfield_count, send_text));
+            numeric_rates.push_back(measure(csound, events, pfield_count, send_numeric));
+        }
+        else
+        {
+            numeric_rates.push_back(measure(csound, events, pfield_count, send_numeric));
+            text_rates.push_back(measure(csound, events, pfield_count, send_text));
+        }
+    }
+    auto text_rate = median(text_rates);
+    auto numeric_rate = median(numeric_rates);
+    std::printf("Events:          %12ld\n", events);
+    std::printf("Pfields:         %12ld\n", pfield_count);
+    std::printf("Rounds:          %12ld\n", rounds);
+    std::printf("Text events/s:   %12.0f (median)\n", text_rate);
+    std::printf("Numeric events/s:%12.0f (median)\n", numeric_rate);
+    std::printf("Speedup:         %12.2f\n", numeric_rate / text_rate);
+    return 0;
+#else
+    std::fprintf(stderr, "This benchmark requires Csound 7.\n");
+    return 1;
+#endif
+}
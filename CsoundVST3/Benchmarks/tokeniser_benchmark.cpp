@@ -0,0 +1,150 @@
+/**
+ * Measures how fast CsoundTokeniser tokenises a large csd, as the code
+ * editor does when it highlights one, and compares the keyword table with
+ * the std::set of std::string that it replaced. Then measures an edit near
+ * the start of the csd while the editor shows its middle, with the
+ * tokeniser attached to the document, as the editor uses it.
+ *
+ * Usage: tokeniser_benchmark [lines]
+ */
+#include "CsoundTokeniser.h"
+#include "CsoundKeywords.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <set>
+#include <string>
+#include <vector>
+
+static const char *instrument = R"(
+instr %d
+; A plucked string with a resonant filter.
+i_amplitude = ampdb(p5) / 2
+i_frequency = cpsmidinn(p4)
+a_envelope transegr 0, 0.005, -3, 1, p3, -6, 0, 0.1, -6, 0
+a_signal pluck i_amplitude, i_frequency, i_frequency, 0, 1
+a_filtered moogladder a_signal, 2000 + 1000 * a_envelope, 0.4
+a_left, a_right pan2 a_filtered * a_envelope, 0.5
+outs a_left, a_right
+prints "instrument %d\n", p1
+endin
+)";
+
+/**
+ * Returns a csd with at least the given number of lines of orchestra.
+ */
+static juce::String makeCsd(int lines)
+{
+    juce::String csd = "<CsoundSynthesizer>\n<CsInstruments>\nsr = 48000\nksmps = 128\nnchnls = 2\n0dbfs = 1\n";
+    for (int line = 0, number = 1; line < lines; line += 12, ++number)
+    {
+        csd << juce::String::formatted(instrument, number, number);
+    }
+    csd << "</CsInstruments>\n<CsScore>\nf 0 60\n</CsScore>\n</CsoundSynthesizer>\n";
+    return csd;
+}
+
+template<typename Function> double measureSeconds(Function function)
+{
+    auto begin = std::chrono::steady_clock::now();
+    function();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return elapsed.count();
+}
+
+int main(int argc, const char **argv)
+{
+    int lines = argc > 1 ? std::atoi(argv[1]) : 100000;
+    juce::CodeDocument document;
+    document.replaceAllContent(makeCsd(lines));
+    CsoundTokeniser tokeniser;
+    long tokens = 0;
+    auto tokenise_seconds = measureSeconds([&]
+    {
+        juce::CodeDocument::Iterator source(document);
+        while (!source.isEOF())
+        {
+            tokeniser.readNextToken(source);
+            ++tokens;
+        }
+    });
+    // Collects the identifiers, to time keyword lookup alone.
+    std::vector<std::string> identifiers;
+    for (const auto &identifier : tokeniser.getIdentifiers(document.getAllContent()))
+    {
+        identifiers.push_back(identifier);
+    }
+    std::set<std::string> keyword_set;
+    for (size_t id = 0; csd_ids[id] != nullptr; ++id)
+    {
+        keyword_set.insert(csd_ids[id]);
+    }
+    constexpr int lookup_passes = 10000;
+    long set_found = 0;
+    auto set_seconds = measureSeconds([&]
+    {
+        for (int pass = 0; pass < lookup_passes; ++pass)
+        {
+            for (const auto &identifier : identifiers)
+            {
+                // As the tokeniser did: a juce::String, converted to UTF-8,
+                // converted to a std::string.
+                juce::String token(identifier);
+                set_found += keyword_set.contains(token.toRawUTF8());
+            }
+        }
+    });
+    long table_found = 0;
+    auto table_seconds = measureSeconds([&]
+    {
+        for (int pass = 0; pass < lookup_passes; ++pass)
+        {
+            for (const auto &identifier : identifiers)
+            {
+                table_found += csound_keywords.contains(identifier);
+            }
+        }
+    });
+    if (set_found != table_found)
+    {
+        std::fprintf(stderr, "The keyword set and table disagree.\n");
+        return 1;
+    }
+    auto lookups = double(lookup_passes) * double(identifiers.size());
+    // Types a character on line 10 while lines in the middle are on
+    // screen, and re-tokenises from line 10 to the end of the screen, as
+    // the code editor does.
+    auto first_visible_line = document.getNumLines() / 2;
+    CsoundTokeniser attached_tokeniser;
+    attached_tokeniser.attach(document, [first_visible_line]
+    {
+        return juce::Range<int>(first_visible_line, first_visible_line + 50);
+    });
+    constexpr int edits = 1000;
+    long edit_tokens = 0;
+    auto edit_seconds = measureSeconds([&]
+    {
+        for (int edit = 0; edit < edits; ++edit)
+        {
+            juce::CodeDocument::Position position(document, 10, 0);
+            document.insertText(position, "x");
+            document.deleteSection(position, position.movedBy(1));
+            juce::CodeDocument::Iterator source(position);
+            while (!source.isEOF() && source.getLine() < first_visible_line + 50)
+            {
+                attached_tokeniser.readNextToken(source);
+                ++edit_tokens;
+            }
+        }
+    });
+    std::printf("Lines:               %12d\n", document.getNumLines());
+    std::printf("Tokens:              %12ld\n", tokens);
+    std::printf("Tokenise seconds:    %12.3f\n", tokenise_seconds);
+    std::printf("Lines/s:             %12.0f\n", document.getNumLines() / tokenise_seconds);
+    std::printf("Set lookups/s:       %12.0f\n", lookups / set_seconds);
+    std::printf("Table lookups/s:     %12.0f\n", lookups / table_seconds);
+    std::printf("Lookup speedup:      %12.2f\n", set_seconds / table_seconds);
+    std::printf("Edit milliseconds:   %12.3f\n", 1000. * edit_seconds / edits);
+    std::printf("Tokens per edit:     %12ld\n", edit_tokens / edits);
+    return 0;
+}
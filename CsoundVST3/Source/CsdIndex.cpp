@@ -0,0 +1,278 @@
+#include "CsdIndex.h"
+#include "CsoundLineStates.h"
+
+#include <algorithm>
+#include <iterator>
+
+const CsdIndex::Block *CsdIndex::Snapshot::find(const std::vector<Block> &blocks, int line)
+{
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), line, [](int line_, const Block &block)
+    {
+        return line_ < block.first_line;
+    });
+    if (it == blocks.begin())
+    {
+        return nullptr;
+    }
+    --it;
+    return line <= it->last_line ? &*it : nullptr;
+}
+
+const CsdIndex::Block *CsdIndex::Snapshot::findElement(int line) const
+{
+    return find(elements, line);
+}
+
+const CsdIndex::Block *CsdIndex::Snapshot::findDefinition(int line) const
+{
+    return find(definitions, line);
+}
+
+const CsdIndex::Block *CsdIndex::Snapshot::findDefinition(const juce::String &name) const
+{
+    auto it = std::lower_bound(names.begin(), names.end(), name, [](const std::pair<juce::String, size_t> &entry, const juce::String &name_)
+    {
+        return entry.first < name_;
+    });
+    if (it == names.end() || it->first != name)
+    {
+        return nullptr;
+    }
+    return &definitions[it->second];
+}
+
+CsdIndex::CsdIndex(juce::CodeDocument &document_)
+    : juce::Thread("CsdIndex"), document(document_)
+{
+    snapshot = std::make_shared<Snapshot>();
+    line_count = document.getNumLines();
+    Edit edit {0, 0, {}};
+    for (int line = 0; line < line_count; ++line)
+    {
+        edit.new_lines.add(document.getLine(line));
+    }
+    edits.push_back(std::move(edit));
+    document.addListener(this);
+    startThread(juce::Thread::Priority::background);
+}
+
+CsdIndex::~CsdIndex()
+{
+    document.removeListener(this);
+    signalThreadShouldExit();
+    notify();
+    stopThread(4000);
+}
+
+std::shared_ptr<const CsdIndex::Snapshot> CsdIndex::getSnapshot() const
+{
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    return snapshot;
+}
+
+void CsdIndex::codeDocumentTextInserted(const juce::String &, int index)
+{
+    postEdit(juce::CodeDocument::Position(document, index).getLineNumber());
+}
+
+void CsdIndex::codeDocumentTextDeleted(int start_index, int)
+{
+    postEdit(juce::CodeDocument::Position(document, start_index).getLineNumber());
+}
+
+/**
+ * An edit changes the line where it starts, and inserts or deletes lines
+ * after it; only the text of the lines that it inserted or changed is
+ * copied for the background thread.
+ */
+void CsdIndex::postEdit(int first_line)
+{
+    auto new_line_count = document.getNumLines();
+    auto added_lines = new_line_count - line_count;
+    line_count = new_line_count;
+    Edit edit {first_line, 1 + std::max(0, -added_lines), {}};
+    for (int line = first_line; line <= first_line + std::max(0, added_lines) && line < new_line_count; ++line)
+    {
+        edit.new_lines.add(document.getLine(line));
+    }
+    {
+        std::lock_guard<std::mutex> lock(edits_mutex);
+        edits.push_back(std::move(edit));
+    }
+    notify();
+}
+
+/**
+ * Applies all pending edits to the line summaries, then publishes one new
+ * snapshot for them.
+ */
+void CsdIndex::run()
+{
+    while (!threadShouldExit())
+    {
+        std::vector<Edit> pending;
+        {
+            std::lock_guard<std::mutex> lock(edits_mutex);
+            pending.swap(edits);
+        }
+        if (pending.empty())
+        {
+            wait(-1);
+            continue;
+        }
+        for (const auto &edit : pending)
+        {
+            auto first = std::min(size_t(edit.first_line), lines.size());
+            auto last = std::min(first + size_t(edit.old_line_count), lines.size());
+            lines.erase(lines.begin() + std::ptrdiff_t(first), lines.begin() + std::ptrdiff_t(last));
+            std::vector<Line> new_lines;
+            new_lines.reserve(size_t(edit.new_lines.size()));
+            for (const auto &text : edit.new_lines)
+            {
+                new_lines.push_back(summarise(text));
+            }
+            lines.insert(lines.begin() + std::ptrdiff_t(first), std::make_move_iterator(new_lines.begin()), std::make_move_iterator(new_lines.end()));
+        }
+        auto new_snapshot = build();
+        {
+            std::lock_guard<std::mutex> lock(snapshot_mutex);
+            snapshot = std::move(new_snapshot);
+        }
+        sendChangeMessage();
+    }
+}
+
+/**
+ * Recognises an element's tag, or an instr, opcode, endin, or endop
+ * statement, at the start of the line.
+ */
+CsdIndex::Line CsdIndex::summarise(const juce::String &text)
+{
+    Line line;
+    line.ends_in_comment[0] = (CsoundLineStates::scanLine(text, 0) & CsoundLineStates::in_comment) != 0;
+    line.ends_in_comment[1] = (CsoundLineStates::scanLine(text, CsoundLineStates::in_comment) & CsoundLineStates::in_comment) != 0;
+    auto trimmed = text.trimStart();
+    if (trimmed.startsWithChar('<'))
+    {
+        auto closing = trimmed[1] == '/';
+        auto name = trimmed.substring(closing ? 2 : 1).initialSectionContainingOnly("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
+        if (name.isNotEmpty() && name != "CsoundSynthesizer")
+        {
+            line.name = name;
+            if (closing)
+            {
+                line.flags = ends_element;
+            }
+            else
+            {
+                line.flags = begins_element;
+                if (trimmed.contains("</" + name))
+                {
+                    line.flags |= ends_element;
+                }
+            }
+        }
+        return line;
+    }
+    auto word = trimmed.initialSectionContainingOnly("abcdefghijklmnopqrstuvwxyz");
+    auto rest = trimmed.substring(word.length());
+    if (rest.isNotEmpty() && (juce::CharacterFunctions::isLetterOrDigit(rest[0]) || rest[0] == '_'))
+    {
+        return line;
+    }
+    if (word == "instr" || word == "opcode")
+    {
+        line.flags = begins_definition;
+        line.kind = word == "instr" ? INSTRUMENT : OPCODE;
+        auto name = rest.upToFirstOccurrenceOf(";", false, false)
+            .upToFirstOccurrenceOf("//", false, false)
+            .upToFirstOccurrenceOf("/*", false, false);
+        if (line.kind == OPCODE)
+        {
+            // An opcode's name is followed by its types or its parameters.
+            name = name.upToFirstOccurrenceOf(",", false, false).upToFirstOccurrenceOf("(", false, false);
+        }
+        line.name = name.trim();
+    }
+    else if (word == "endin" || word == "endop")
+    {
+        line.flags = ends_definition;
+    }
+    return line;
+}
+
+/**
+ * Elements are not nested; definitions count only in <CsInstruments>, or
+ * outside any element, and a definition that is not ended ends where the
+ * next definition or element begins, or where its element ends.
+ */
+std::shared_ptr<const CsdIndex::Snapshot> CsdIndex::build() const
+{
+    auto result = std::make_shared<Snapshot>();
+    auto &elements = result->elements;
+    auto &definitions = result->definitions;
+    auto last_line = int(lines.size()) - 1;
+    Block *element = nullptr;
+    Block *definition = nullptr;
+    bool in_comment = false;
+    for (int index = 0; index <= last_line; ++index)
+    {
+        const auto &line = lines[size_t(index)];
+        if (!in_comment && line.flags != 0)
+        {
+            if ((line.flags & begins_element) != 0 && element == nullptr)
+            {
+                if (definition != nullptr)
+                {
+                    definition->last_line = index - 1;
+                    definition = nullptr;
+                }
+                elements.push_back({ELEMENT, line.name, index, last_line});
+                element = &elements.back();
+            }
+            if ((line.flags & ends_element) != 0 && element != nullptr && element->name == line.name)
+            {
+                element->last_line = index;
+                element = nullptr;
+                if (definition != nullptr)
+                {
+                    definition->last_line = index - 1;
+                    definition = nullptr;
+                }
+            }
+            auto in_orchestra = element == nullptr || element->name == "CsInstruments";
+            if ((line.flags & begins_definition) != 0 && in_orchestra)
+            {
+                if (definition != nullptr)
+                {
+                    definition->last_line = index - 1;
+                }
+                definitions.push_back({Kind(line.kind), line.name, index, last_line});
+                definition = &definitions.back();
+            }
+            if ((line.flags & ends_definition) != 0 && definition != nullptr)
+            {
+                definition->last_line = index;
+                definition = nullptr;
+            }
+        }
+        in_comment = line.ends_in_comment[in_comment ? 1 : 0];
+    }
+    for (size_t index = 0; index < definitions.size(); ++index)
+    {
+        const auto &block = definitions[index];
+        if (block.kind == INSTRUMENT)
+        {
+            for (const auto &name : juce::StringArray::fromTokens(block.name, ",", ""))
+            {
+                result->names.emplace_back(name.trim(), index);
+            }
+        }
+        else
+        {
+            result->names.emplace_back(block.name, index);
+        }
+    }
+    std::sort(result->names.begin(), result->names.end());
+    return result;
+}
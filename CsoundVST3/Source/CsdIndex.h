@@ -0,0 +1,134 @@
+#pragma once
+
+#include <juce_gui_extra/juce_gui_extra.h>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * An index of the structure of a csd: where its elements, such as
+ * <CsOptions>, <CsInstruments>, and <CsScore>, and its instr/endin and
+ * opcode/endop blocks begin and end.
+ *
+ * The index listens to the document. Each edit passes only the changed
+ * lines to a background thread, which keeps a summary of every line and
+ * rebuilds the index from the summaries, not from the text. Each rebuild
+ * publishes an immutable Snapshot, which any thread may query, and sends a
+ * change message.
+ */
+class CsdIndex : public juce::ChangeBroadcaster,
+private juce::CodeDocument::Listener,
+private juce::Thread
+{
+public:
+    enum Kind
+    {
+        ELEMENT = 0,
+        INSTRUMENT,
+        OPCODE,
+    };
+    /**
+     * An element or a definition, from its first line to its last line,
+     * inclusive. An instrument's name is its instr statement's list of
+     * numbers and names, as written.
+     */
+    struct Block
+    {
+        Kind kind;
+        juce::String name;
+        int first_line;
+        int last_line;
+    };
+    class Snapshot
+    {
+    public:
+        /**
+         * Elements, in order.
+         */
+        const std::vector<Block> &getElements() const
+        {
+            return elements;
+        }
+        /**
+         * Instruments and opcodes, in order.
+         */
+        const std::vector<Block> &getDefinitions() const
+        {
+            return definitions;
+        }
+        /**
+         * Returns the element that contains the line, or null.
+         */
+        const Block *findElement(int line) const;
+        /**
+         * Returns the instrument or opcode that contains the line, or null.
+         */
+        const Block *findDefinition(int line) const;
+        /**
+         * Returns the instrument with the number or name, or the opcode with
+         * the name, or null.
+         */
+        const Block *findDefinition(const juce::String &name) const;
+
+    private:
+        friend class CsdIndex;
+        static const Block *find(const std::vector<Block> &blocks, int line);
+        std::vector<Block> elements;
+        std::vector<Block> definitions;
+        /**
+         * Each name of each definition, with the definition's index, sorted
+         * by name.
+         */
+        std::vector<std::pair<juce::String, size_t>> names;
+    };
+    CsdIndex(juce::CodeDocument &document);
+    ~CsdIndex() override;
+    std::shared_ptr<const Snapshot> getSnapshot() const;
+
+private:
+    /**
+     * Lines [first_line, first_line + old_line_count) were replaced by
+     * new_lines.
+     */
+    struct Edit
+    {
+        int first_line;
+        int old_line_count;
+        juce::StringArray new_lines;
+    };
+    enum LineFlags : uint8_t
+    {
+        begins_element = 1,
+        ends_element = 2,
+        begins_definition = 4,
+        ends_definition = 8,
+    };
+    /**
+     * What a line contributes to the index. A line's statement or tag
+     * counts only if the line does not start in a block comment, so the
+     * summary also holds whether the line ends in one, for each state at
+     * its start.
+     */
+    struct Line
+    {
+        uint8_t flags = 0;
+        uint8_t kind = ELEMENT;
+        bool ends_in_comment[2] = {false, true};
+        juce::String name;
+    };
+    void codeDocumentTextInserted(const juce::String &text, int index) override;
+    void codeDocumentTextDeleted(int start_index, int end_index) override;
+    void postEdit(int first_line);
+    void run() override;
+    static Line summarise(const juce::String &text);
+    std::shared_ptr<const Snapshot> build() const;
+    juce::CodeDocument &document;
+    int line_count = 0;
+    std::mutex edits_mutex;
+    std::vector<Edit> edits;
+    std::vector<Line> lines;
+    mutable std::mutex snapshot_mutex;
+    std::shared_ptr<const Snapshot> snapshot;
+};
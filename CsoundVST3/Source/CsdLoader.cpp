@@ -0,0 +1,193 @@
+#include "CsdLoader.h"
+
+#include <cstdint>
+#include <cstring>
+
+CsdLoader::CsdLoader(juce::CodeDocument &document_)
+    : document(document_)
+{
+}
+
+CsdLoader::~CsdLoader()
+{
+    stopTimer();
+}
+
+bool CsdLoader::load(const juce::File &file)
+{
+    cancel();
+    mapped_file = std::make_unique<juce::MemoryMappedFile>(file, juce::MemoryMappedFile::readOnly);
+    data = static_cast<const char *>(mapped_file->getData());
+    size = mapped_file->getSize();
+    if (data == nullptr || !isValidUtf8(data, size))
+    {
+        // An empty file cannot be mapped, and other encodings must be
+        // decoded.
+        mapped_file.reset();
+        if (!file.existsAsFile())
+        {
+            data = nullptr;
+            size = 0;
+            return false;
+        }
+        decoded_text = file.loadFileAsString();
+        data = decoded_text.toRawUTF8();
+        size = decoded_text.getNumBytesAsUTF8();
+    }
+    if (size >= 3 && std::memcmp(data, "\xef\xbb\xbf", 3) == 0)
+    {
+        offset = 3;
+    }
+    document.replaceAllContent({});
+    startTimer(1);
+    return true;
+}
+
+void CsdLoader::cancel()
+{
+    stopTimer();
+    mapped_file.reset();
+    decoded_text = {};
+    data = nullptr;
+    size = 0;
+    offset = 0;
+}
+
+bool CsdLoader::isLoading() const
+{
+    return data != nullptr;
+}
+
+double CsdLoader::getProgress() const
+{
+    return size == 0 ? 1. : double(offset) / double(size);
+}
+
+bool CsdLoader::isValidUtf8(const char *text, size_t length)
+{
+    auto bytes = reinterpret_cast<const uint8_t *>(text);
+    size_t index = 0;
+    while (index < length)
+    {
+        for (; index + 8 <= length; index += 8)
+        {
+            uint64_t word;
+            std::memcpy(&word, bytes + index, 8);
+            if ((word & 0x8080808080808080ull) != 0)
+            {
+                break;
+            }
+        }
+        if (index == length)
+        {
+            break;
+        }
+        auto byte = bytes[index];
+        if (byte < 0x80)
+        {
+            ++index;
+            continue;
+        }
+        size_t sequence_length;
+        uint32_t code_point;
+        uint32_t minimum;
+        if ((byte & 0xe0) == 0xc0)
+        {
+            sequence_length = 2;
+            code_point = byte & 0x1fu;
+            minimum = 0x80;
+        }
+        else if ((byte & 0xf0) == 0xe0)
+        {
+            sequence_length = 3;
+            code_point = byte & 0x0fu;
+            minimum = 0x800;
+        }
+        else if ((byte & 0xf8) == 0xf0)
+        {
+            sequence_length = 4;
+            code_point = byte & 0x07u;
+            minimum = 0x10000;
+        }
+        else
+        {
+            return false;
+        }
+        if (length - index < sequence_length)
+        {
+            return false;
+        }
+        for (size_t i = 1; i < sequence_length; ++i)
+        {
+            auto next = bytes[index + i];
+            if ((next & 0xc0) != 0x80)
+            {
+                return false;
+            }
+            code_point = (code_point << 6) | (next & 0x3fu);
+        }
+        // Rejects overlong encodings, surrogates, and code points beyond
+        // Unicode.
+        if (code_point < minimum || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff))
+        {
+            return false;
+        }
+        index += sequence_length;
+    }
+    return true;
+}
+
+size_t CsdLoader::findChunkEnd() const
+{
+    if (size - offset <= chunk_bytes)
+    {
+        return size;
+    }
+    auto end = offset + chunk_bytes;
+    auto newline = static_cast<const char *>(std::memchr(data + offset, '\n', chunk_bytes));
+    if (newline != nullptr)
+    {
+        // The last newline in the chunk.
+        while (end > offset && data[end - 1] != '\n')
+        {
+            --end;
+        }
+        return end;
+    }
+    while (end > offset && (uint8_t(data[end]) & 0xc0) == 0x80)
+    {
+        --end;
+    }
+    return end;
+}
+
+/**
+ * Inserts one chunk at the end of the document. Loading is not undoable:
+ * the undo history is cleared once the whole file has been inserted.
+ */
+void CsdLoader::timerCallback()
+{
+    auto end = findChunkEnd();
+    document.insertText(document.getNumCharacters(), juce::String::fromUTF8(data + offset, int(end - offset)));
+    offset = end;
+    if (offset == size)
+    {
+        finish();
+        return;
+    }
+    if (onProgress)
+    {
+        onProgress();
+    }
+}
+
+void CsdLoader::finish()
+{
+    cancel();
+    document.clearUndoHistory();
+    document.setSavePoint();
+    if (onLoaded)
+    {
+        onLoaded();
+    }
+}
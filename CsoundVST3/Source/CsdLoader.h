@@ -0,0 +1,69 @@
+#pragma once
+
+#include <juce_gui_extra/juce_gui_extra.h>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+/**
+ * Loads a csd file into a CodeDocument without blocking the message thread.
+ *
+ * The file is memory-mapped rather than read, and validated as UTF-8 in
+ * place. Then the loader inserts it into the document a chunk of whole
+ * lines at a time, on a timer, so that the editor stays responsive while a
+ * very large csd loads. The whole text is never copied, except into the
+ * document's own lines.
+ * A file that is not UTF-8 is read and decoded as JUCE reads any text
+ * file, and then inserted in the same way.
+ */
+class CsdLoader : private juce::Timer
+{
+public:
+    /**
+     * The most bytes inserted per timer tick.
+     */
+    static constexpr size_t chunk_bytes = 256 * 1024;
+    CsdLoader(juce::CodeDocument &document);
+    ~CsdLoader() override;
+    /**
+     * Starts loading the file, replacing the document's content, and
+     * cancelling any load in progress. Returns false if the file cannot be
+     * read.
+     */
+    bool load(const juce::File &file);
+    void cancel();
+    bool isLoading() const;
+    /**
+     * Returns the fraction of the file that has been inserted.
+     */
+    double getProgress() const;
+    /**
+     * Returns whether the text is well-formed UTF-8. Skips ASCII eight
+     * bytes at a time.
+     */
+    static bool isValidUtf8(const char *data, size_t size);
+    /**
+     * Called after each chunk, and once the whole file has been inserted.
+     */
+    std::function<void()> onProgress;
+    std::function<void()> onLoaded;
+
+private:
+    void timerCallback() override;
+    /**
+     * Returns the end of the next chunk, after its last newline, or else at
+     * a character boundary.
+     */
+    size_t findChunkEnd() const;
+    void finish();
+    juce::CodeDocument &document;
+    std::unique_ptr<juce::MemoryMappedFile> mapped_file;
+    /**
+     * The text of a file that is not UTF-8, which data points into.
+     */
+    juce::String decoded_text;
+    const char *data = nullptr;
+    size_t size = 0;
+    size_t offset = 0;
+};
@@ -0,0 +1,342 @@
+#include "CsdSearch.h"
+
+#include <algorithm>
+
+/**
+ * Returns the line's ending, which the regex does not see.
+ */
+static juce::String getLineEnding(const juce::String &line)
+{
+    if (line.endsWith("\r\n"))
+    {
+        return "\r\n";
+    }
+    if (line.endsWithChar('\n') || line.endsWithChar('\r'))
+    {
+        return line.getLastCharacters(1);
+    }
+    return {};
+}
+
+bool CsdSearch::setPattern(const juce::String &pattern_, bool use_regex, bool match_case_, juce::String &error)
+{
+    pattern = pattern_;
+    match_case = match_case_;
+    regex.reset();
+    if (use_regex && pattern.isNotEmpty())
+    {
+        auto flags = std::regex_constants::ECMAScript;
+        if (!match_case)
+        {
+            flags |= std::regex_constants::icase;
+        }
+        try
+        {
+            regex = std::make_unique<std::wregex>(pattern.toWideCharPointer(), flags);
+        }
+        catch (const std::regex_error &e)
+        {
+            error = e.what();
+            pattern.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CsdSearch::isEmpty() const
+{
+    return pattern.isEmpty();
+}
+
+std::optional<CsdSearch::Match> CsdSearch::findNext(const juce::CodeDocument &document, int position) const
+{
+    auto line_count = document.getNumLines();
+    if (isEmpty() || line_count == 0)
+    {
+        return std::nullopt;
+    }
+    juce::CodeDocument::Position start(document, position);
+    // The last step searches the start line again from its beginning, to
+    // wrap around to matches before the start.
+    for (int step = 0; step <= line_count; ++step)
+    {
+        auto line = (start.getLineNumber() + step) % line_count;
+        int match_index;
+        int match_length;
+        if (findInLine(document.getLine(line), step == 0 ? start.getIndexInLine() : 0, match_index, match_length))
+        {
+            return Match {juce::CodeDocument::Position(document, line, 0).getPosition() + match_index, match_length};
+        }
+    }
+    return std::nullopt;
+}
+
+bool CsdSearch::matches(const juce::CodeDocument &document, juce::Range<int> region) const
+{
+    if (isEmpty() || region.isEmpty())
+    {
+        return false;
+    }
+    juce::CodeDocument::Position start(document, region.getStart());
+    int match_index;
+    int match_length;
+    return findInLine(document.getLine(start.getLineNumber()), start.getIndexInLine(), match_index, match_length)
+        && match_index == start.getIndexInLine() && match_length == region.getLength();
+}
+
+int CsdSearch::countMatches(const juce::CodeDocument &document) const
+{
+    if (isEmpty())
+    {
+        return 0;
+    }
+    int count = 0;
+    for (int line = 0; line < document.getNumLines(); ++line)
+    {
+        auto text = document.getLine(line);
+        int match_index;
+        int match_length;
+        for (int index = 0; findInLine(text, index, match_index, match_length); index = match_index + match_length)
+        {
+            ++count;
+        }
+    }
+    return count;
+}
+
+int CsdSearch::replace(juce::CodeDocument &document, juce::Range<int> region, const juce::String &replacement) const
+{
+    if (!matches(document, region))
+    {
+        return -1;
+    }
+    auto text = replacement;
+    if (regex != nullptr)
+    {
+        juce::CodeDocument::Position start(document, region.getStart());
+        const auto &line = widen(document.getLine(start.getLineNumber()));
+        std::wsmatch match;
+        searchRegex(line, toBufferIndex(start.getIndexInLine()), match);
+        text = juce::String(match.format(std::wstring(replacement.toWideCharPointer())).c_str());
+    }
+    document.newTransaction();
+    document.replaceSection(region.getStart(), region.getEnd(), text);
+    document.newTransaction();
+    return text.length();
+}
+
+/**
+ * Builds the new text of the span of lines from the first line with a
+ * match to the last, copying the unchanged lines between them, and
+ * replaces the span in one edit, so that the document updates its lines
+ * once rather than once per match.
+ */
+int CsdSearch::replaceAll(juce::CodeDocument &document, const juce::String &replacement) const
+{
+    if (isEmpty())
+    {
+        return 0;
+    }
+    int count = 0;
+    int first_line = -1;
+    int last_line = -1;
+    std::string text;
+    auto append = [&text](const juce::String &line)
+    {
+        text.append(line.toRawUTF8(), line.getNumBytesAsUTF8());
+    };
+    for (int line = 0; line < document.getNumLines(); ++line)
+    {
+        int line_count = 0;
+        auto replaced = replaceInLine(document.getLine(line), replacement, line_count);
+        if (line_count == 0)
+        {
+            continue;
+        }
+        if (first_line < 0)
+        {
+            first_line = line;
+        }
+        else
+        {
+            for (auto unchanged_line = last_line + 1; unchanged_line < line; ++unchanged_line)
+            {
+                append(document.getLine(unchanged_line));
+            }
+        }
+        append(replaced);
+        last_line = line;
+        count += line_count;
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+    auto start = juce::CodeDocument::Position(document, first_line, 0).getPosition();
+    auto end = last_line + 1 < document.getNumLines() ? juce::CodeDocument::Position(document, last_line + 1, 0).getPosition() : document.getNumCharacters();
+    document.newTransaction();
+    document.replaceSection(start, end, juce::String::fromUTF8(text.data(), int(text.size())));
+    document.newTransaction();
+    return count;
+}
+
+bool CsdSearch::findInLine(const juce::String &line, int index, int &match_index, int &match_length) const
+{
+    if (regex == nullptr)
+    {
+        match_index = match_case ? line.indexOf(index, pattern) : line.indexOfIgnoreCase(index, pattern);
+        match_length = pattern.length();
+        return match_index >= 0;
+    }
+    const auto &text = widen(line);
+    std::wsmatch match;
+    if (!searchRegex(text, toBufferIndex(index), match))
+    {
+        return false;
+    }
+    match_index = toLineIndex(size_t(match[0].first - text.begin()));
+    match_length = toLineIndex(size_t(match[0].second - text.begin())) - match_index;
+    return true;
+}
+
+/**
+ * Searches from index, skipping empty matches, which cannot be selected or
+ * replaced usefully.
+ */
+bool CsdSearch::searchRegex(const std::wstring &text, size_t index, std::wsmatch &match) const
+{
+    if (index > text.size())
+    {
+        return false;
+    }
+    auto begin = text.begin() + std::ptrdiff_t(index);
+    auto flags = index > 0 ? std::regex_constants::match_prev_avail : std::regex_constants::match_default;
+    while (std::regex_search(begin, text.end(), match, *regex, flags))
+    {
+        if (match.length(0) > 0)
+        {
+            return true;
+        }
+        if (match[0].first == text.end())
+        {
+            return false;
+        }
+        begin = match[0].first + 1;
+        flags = std::regex_constants::match_prev_avail;
+    }
+    return false;
+}
+
+juce::String CsdSearch::replaceInLine(const juce::String &line, const juce::String &replacement, int &count) const
+{
+    if (regex == nullptr)
+    {
+        int match_index;
+        int match_length;
+        if (!findInLine(line, 0, match_index, match_length))
+        {
+            return line;
+        }
+        juce::String result;
+        int index = 0;
+        do
+        {
+            result << line.substring(index, match_index) << replacement;
+            index = match_index + match_length;
+            ++count;
+        }
+        while (findInLine(line, index, match_index, match_length));
+        return result + line.substring(index);
+    }
+    const auto &text = widen(line);
+    std::wsmatch match;
+    if (!searchRegex(text, 0, match))
+    {
+        return line;
+    }
+    std::wstring format(replacement.toWideCharPointer());
+    std::wstring result;
+    size_t index = 0;
+    do
+    {
+        result.append(text.begin() + std::ptrdiff_t(index), match[0].first);
+        result += match.format(format);
+        index = size_t(match[0].second - text.begin());
+        ++count;
+    }
+    while (searchRegex(text, index, match));
+    result.append(text.begin() + std::ptrdiff_t(index), text.end());
+    return juce::String(result.c_str()) + getLineEnding(line);
+}
+
+/**
+ * Where wchar_t has 32 bits, one wide character per JUCE character, so that
+ * indexes in the buffer are indexes in the line. Where it has 16 bits, as
+ * on Windows, a character outside the Basic Multilingual Plane is a
+ * surrogate pair, which the regex sees as two characters.
+ */
+const std::wstring &CsdSearch::widen(const juce::String &line) const
+{
+    buffer.clear();
+    line_indexes.clear();
+    int index = 0;
+    for (auto p = line.getCharPointer(); !p.isEmpty(); ++index)
+    {
+        auto character = p.getAndAdvance();
+        if (sizeof(wchar_t) == 2 && character >= 0x10000)
+        {
+            if (line_indexes.empty())
+            {
+                for (int prior = 0; prior < index; ++prior)
+                {
+                    line_indexes.push_back(prior);
+                }
+            }
+            buffer.push_back(wchar_t(0xD800 + ((character - 0x10000) >> 10)));
+            buffer.push_back(wchar_t(0xDC00 + ((character - 0x10000) & 0x3FF)));
+            line_indexes.push_back(index);
+            line_indexes.push_back(index);
+            continue;
+        }
+        buffer.push_back(wchar_t(character));
+        if (!line_indexes.empty())
+        {
+            line_indexes.push_back(index);
+        }
+    }
+    while (!buffer.empty() && (buffer.back() == L'\n' || buffer.back() == L'\r'))
+    {
+        buffer.pop_back();
+        if (!line_indexes.empty())
+        {
+            line_indexes.pop_back();
+        }
+    }
+    if (!line_indexes.empty())
+    {
+        line_indexes.push_back(line_indexes.back() + 1);
+    }
+    return buffer;
+}
+
+size_t CsdSearch::toBufferIndex(int index) const
+{
+    if (line_indexes.empty())
+    {
+        return size_t(index);
+    }
+    return size_t(std::lower_bound(line_indexes.begin(), line_indexes.end(), index) - line_indexes.begin());
+}
+
+/**
+ * An index in the middle of a surrogate pair is the index of its character.
+ */
+int CsdSearch::toLineIndex(size_t buffer_index) const
+{
+    if (line_indexes.empty())
+    {
+        return int(buffer_index);
+    }
+    return line_indexes[std::min(buffer_index, line_indexes.size() - 1)];
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <juce_gui_extra/juce_gui_extra.h>
+
+#include <memory>
+#include <optional>
+#include <regex>
+#include <string>
+#include <vector>
+
+/**
+ * Finds and replaces text in a CodeDocument, line by line, so that no search
+ * copies the document. Lines share their text with the document, so reading
+ * a line copies nothing either. A pattern may be plain text or an
+ * ECMAScript regular expression, and may match case or not; it matches
+ * within a line, without its line ending, so that $ matches at the end of
+ * the line.
+ */
+class CsdSearch
+{
+public:
+    struct Match
+    {
+        int position;
+        int length;
+    };
+    /**
+     * Sets the pattern. Returns false, and sets error, if the regular
+     * expression is not valid.
+     */
+    bool setPattern(const juce::String &pattern, bool regex, bool match_case, juce::String &error);
+    bool isEmpty() const;
+    /**
+     * Returns the first match that starts at or after position, wrapping
+     * around to the start of the document.
+     */
+    std::optional<Match> findNext(const juce::CodeDocument &document, int position) const;
+    /**
+     * Returns whether a match spans exactly the region.
+     */
+    bool matches(const juce::CodeDocument &document, juce::Range<int> region) const;
+    int countMatches(const juce::CodeDocument &document) const;
+    /**
+     * Replaces the match that spans exactly the region, and returns the
+     * length of its replacement. For a regular expression, the replacement
+     * may refer to groups as $1, $2, and so on.
+     */
+    int replace(juce::CodeDocument &document, juce::Range<int> region, const juce::String &replacement) const;
+    /**
+     * Replaces every match in one pass, as one edit that is one undo
+     * transaction, and returns the number of matches replaced.
+     */
+    int replaceAll(juce::CodeDocument &document, const juce::String &replacement) const;
+
+private:
+    /**
+     * Finds the first match in the line at or after index.
+     */
+    bool findInLine(const juce::String &line, int index, int &match_index, int &match_length) const;
+    bool searchRegex(const std::wstring &text, size_t index, std::wsmatch &match) const;
+    /**
+     * Returns the line with every match replaced, and adds the number of
+     * matches to count.
+     */
+    juce::String replaceInLine(const juce::String &line, const juce::String &replacement, int &count) const;
+    /**
+     * Copies a line, without its line ending, into the reused wide string
+     * buffer for the regex.
+     */
+    const std::wstring &widen(const juce::String &line) const;
+    /**
+     * Convert between indexes in the line and in the buffer, which differ
+     * where the buffer holds a character as a UTF-16 surrogate pair.
+     */
+    size_t toBufferIndex(int index) const;
+    int toLineIndex(size_t buffer_index) const;
+    juce::String pattern;
+    bool match_case = false;
+    std::unique_ptr<std::wregex> regex;
+    mutable std::wstring buffer;
+    /**
+     * Where wchar_t has 16 bits and the line has characters outside the
+     * Basic Multilingual Plane, the index in the line of each element of
+     * the buffer, and of its end; otherwise empty, as the indexes are the
+     * same.
+     */
+    mutable std::vector<int> line_indexes;
+};
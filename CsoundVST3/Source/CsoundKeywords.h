@@ -0,0 +1,113 @@
+#pragma once
+
+#include "csd_ids.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * The identifiers in csd_ids, in an open-addressing hash table. Looking up
+ * a token hashes it once and compares it only with keywords in its probe
+ * sequence that have the same hash, usually none or one, without building
+ * a string or allocating.
+ *
+ * The table is built by a constexpr function, so that compilers normally
+ * build it at compile time; a compiler whose constexpr evaluation limits it
+ * exceeds builds it once, at startup, instead.
+ */
+class CsoundKeywords
+{
+public:
+    static constexpr size_t table_size = 8192;
+    /**
+     * Tokens longer than this are not keywords, so a tokeniser can scan
+     * tokens into a buffer of this size.
+     */
+    static constexpr size_t maximum_length = 64;
+    static constexpr size_t getCount()
+    {
+        size_t count = 0;
+        while (csd_ids[count] != nullptr)
+        {
+            ++count;
+        }
+        return count;
+    }
+    /**
+     * 32-bit FNV-1a hash.
+     */
+    static constexpr uint32_t hash(std::string_view text)
+    {
+        uint32_t result = 0x811c9dc5u;
+        for (auto c : text)
+        {
+            result ^= uint8_t(c);
+            result *= 0x01000193u;
+        }
+        return result;
+    }
+    static constexpr CsoundKeywords build()
+    {
+        CsoundKeywords keywords;
+        for (size_t id = 0; csd_ids[id] != nullptr; ++id)
+        {
+            std::string_view keyword(csd_ids[id]);
+            if (keyword.size() > maximum_length)
+            {
+                continue;
+            }
+            auto keyword_hash = hash(keyword);
+            auto index = keywords.find(keyword, keyword_hash);
+            auto &slot = keywords.slots[index];
+            if (slot.id == 0)
+            {
+                slot.hash = keyword_hash;
+                slot.id = uint16_t(id + 1);
+                slot.length = uint16_t(keyword.size());
+            }
+        }
+        return keywords;
+    }
+    constexpr bool contains(std::string_view token) const
+    {
+        return !token.empty() && slots[find(token, hash(token))].id != 0;
+    }
+
+private:
+    /**
+     * The hash, the index in csd_ids plus 1 (or 0 for an empty slot), and
+     * the length of a keyword.
+     */
+    struct Slot
+    {
+        uint32_t hash = 0;
+        uint16_t id = 0;
+        uint16_t length = 0;
+    };
+    /**
+     * Returns the slot that holds the token, or else the empty slot where
+     * it would be inserted.
+     */
+    constexpr size_t find(std::string_view token, uint32_t token_hash) const
+    {
+        auto index = token_hash & (table_size - 1);
+        for (;;)
+        {
+            const auto &slot = slots[index];
+            if (slot.id == 0 || (slot.hash == token_hash && slot.length == token.size() && std::string_view(csd_ids[slot.id - 1], slot.length) == token))
+            {
+                return index;
+            }
+            index = (index + 1) & (table_size - 1);
+        }
+    }
+    std::array<Slot, table_size> slots {};
+};
+
+static_assert((CsoundKeywords::table_size & (CsoundKeywords::table_size - 1)) == 0, "The table size must be a power of 2.");
+static_assert(CsoundKeywords::getCount() * 2 <= CsoundKeywords::table_size, "The keyword table must be at most half full.");
+static_assert(CsoundKeywords::getCount() < 0xffff, "Keyword ids must fit in 16 bits.");
+
+inline const CsoundKeywords csound_keywords = CsoundKeywords::build();
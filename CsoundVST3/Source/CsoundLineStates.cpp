@@ -0,0 +1,108 @@
+#include "CsoundLineStates.h"
+
+CsoundLineStates::CsoundLineStates(juce::CodeDocument &document_)
+    : document(document_)
+{
+    document.addListener(this);
+    update(0);
+}
+
+CsoundLineStates::~CsoundLineStates()
+{
+    document.removeListener(this);
+}
+
+/**
+ * Follows the tokeniser's rules: a block comment runs to its end, which may
+ * be on a later line; a line comment or a string runs at most to the end of
+ * the line; and element tags count only outside comments and strings.
+ */
+uint8_t CsoundLineStates::scanLine(const juce::String &text, uint8_t state)
+{
+    for (auto p = text.getCharPointer(); !p.isEmpty(); )
+    {
+        auto c = p.getAndAdvance();
+        if ((state & in_comment) != 0)
+        {
+            if (c == '*' && *p == '/')
+            {
+                ++p;
+                state &= ~in_comment;
+            }
+        }
+        else if (c == ';' || (c == '/' && *p == '/'))
+        {
+            break;
+        }
+        else if (c == '/' && *p == '*')
+        {
+            ++p;
+            state |= in_comment;
+        }
+        else if (c == '"')
+        {
+            while (!p.isEmpty() && *p != '"' && *p != '\n')
+            {
+                if (p.getAndAdvance() == '\\' && !p.isEmpty() && *p != '\n')
+                {
+                    ++p;
+                }
+            }
+            if (*p == '"')
+            {
+                ++p;
+            }
+        }
+        else if (c == '<')
+        {
+            if (juce::CharacterFunctions::compareUpTo(p, juce::CharPointer_ASCII("CsScore"), 7) == 0)
+            {
+                state |= in_score;
+            }
+            else if (juce::CharacterFunctions::compareUpTo(p, juce::CharPointer_ASCII("/CsScore"), 8) == 0)
+            {
+                state &= ~in_score;
+            }
+        }
+    }
+    return state;
+}
+
+void CsoundLineStates::codeDocumentTextInserted(const juce::String &, int index)
+{
+    update(juce::CodeDocument::Position(document, index).getLineNumber());
+}
+
+void CsoundLineStates::codeDocumentTextDeleted(int start_index, int)
+{
+    update(juce::CodeDocument::Position(document, start_index).getLineNumber());
+}
+
+void CsoundLineStates::update(int first_line)
+{
+    auto line_count = std::max(1, document.getNumLines());
+    first_line = juce::jlimit(0, line_count - 1, first_line);
+    auto added_lines = line_count - int(states.size());
+    auto after_first = states.begin() + std::min(first_line + 1, int(states.size()));
+    if (added_lines > 0)
+    {
+        states.insert(after_first, size_t(added_lines), uint8_t(0));
+    }
+    else if (added_lines < 0)
+    {
+        states.erase(after_first, after_first - added_lines);
+    }
+    states[0] = 0;
+    // The first line and any inserted lines have changed; the lines after
+    // them are scanned only until their state is unchanged.
+    auto last_changed_line = first_line + std::max(0, added_lines);
+    for (auto line = first_line; line + 1 < line_count; ++line)
+    {
+        auto state = scanLine(document.getLine(line), states[size_t(line)]);
+        if (line >= last_changed_line && state == states[size_t(line + 1)])
+        {
+            break;
+        }
+        states[size_t(line + 1)] = state;
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <juce_gui_extra/juce_gui_extra.h>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Keeps the lexical state at the start of each line of a csd: whether the
+ * line starts inside a block comment, and whether it is in the
+ * <CsScore> element. With these states any line start is a place where
+ * tokenising can begin, so that a tokeniser need not read the document from
+ * its start.
+ *
+ * After an edit, only the changed lines are scanned, and then the lines
+ * after them until a line's state is the same as before the edit; so the
+ * cost of an edit is proportional to what it changed, not to the size of
+ * the document.
+ */
+class CsoundLineStates : public juce::CodeDocument::Listener
+{
+public:
+    enum State : uint8_t
+    {
+        in_comment = 1,
+        in_score = 2,
+    };
+    CsoundLineStates(juce::CodeDocument &document);
+    ~CsoundLineStates() override;
+    uint8_t getState(int line) const
+    {
+        return line >= 0 && line < int(states.size()) ? states[size_t(line)] : 0;
+    }
+    /**
+     * Returns the state at the start of the line after a line of text that
+     * starts in the given state.
+     */
+    static uint8_t scanLine(const juce::String &text, uint8_t state);
+    void codeDocumentTextInserted(const juce::String &text, int index) override;
+    void codeDocumentTextDeleted(int start_index, int end_index) override;
+
+private:
+    /**
+     * Resizes the states for the lines inserted or deleted after the first
+     * changed line, and rescans from that line.
+     */
+    void update(int first_line);
+    juce::CodeDocument &document;
+    std::vector<uint8_t> states;
+};
@@ -2,10 +2,8 @@
 #include <juce_audio_utils/juce_audio_utils.h>
 #include <juce_gui_extra/juce_gui_extra.h>
 #include "CsoundTokeniser.h"
-#include "csd_ids.h"
+#include "CsoundKeywords.h"
 
-/// juce::StringArray csoundKeywords;
-std::set<std::string> csound_keywords;
 /// const juce::StringArray csoundOpcodes = { "oscil", "adsr", "reverb" };
 
 CsoundTokeniser::CsoundTokeniser() {
@@ -16,18 +14,60 @@ CsoundTokeniser::CsoundTokeniser() {
     csd_color_scheme.set("Comment", juce::Colours::lightgreen);
     csd_color_scheme.set("Identifier", juce::Colours::powderblue);
     csd_color_scheme.set("Other", juce::Colours::wheat);
-    for (int i = 0; ; ++i)
+}
+
+void CsoundTokeniser::attach(juce::CodeDocument &document, std::function<juce::Range<int>()> visible_lines_)
+{
+    attached_document = &document;
+    visible_lines = std::move(visible_lines_);
+    line_states = std::make_unique<CsoundLineStates>(document);
+}
+
+void CsoundTokeniser::setOpcodeCatalogue(const OpcodeCatalogue *catalogue)
+{
+    opcode_catalogue = catalogue;
+}
+
+/**
+ * Unless attached to a document, reads the csd from its start as an
+ * orchestra. When attached, begins each line in its cached state, and
+ * reads whitespace only to the end of a line, so that every line start is a
+ * token boundary. A block comment is read one line at a time for the same
+ * reason.
+ */
+int CsoundTokeniser::readNextToken(juce::CodeDocument::Iterator& source)
+{
+    if (line_states == nullptr)
+        return readOrchestraToken(source, false);
+    auto line = source.getLine();
+    auto visible = visible_lines();
+    if (!visible.contains(line))
     {
-        const char *keyword = csd_ids[i];
-        if (keyword == nullptr)
+        // Lines that are not visible are read as one token, up to the first
+        // visible line or else to the end of the document, so that the
+        // editor skips past them without reading their text.
+        auto end_line = line < visible.getStart() ? visible.getStart() : attached_document->getNumLines();
+        source = juce::CodeDocument::Iterator(juce::CodeDocument::Position(*attached_document, end_line, 0));
+        return CsoundOther;
+    }
+    auto state = line_states->getState(line);
+    if ((state & CsoundLineStates::in_comment) != 0 && (source.isSOF() || source.peekPreviousChar() == '\n'))
+        return readBlockComment(source, true);
+    if (juce::CharacterFunctions::isWhitespace(source.peekNextChar()))
+    {
+        while (juce::CharacterFunctions::isWhitespace(source.peekNextChar()))
         {
-            break;
+            if (source.nextChar() == '\n')
+                break;
         }
-        csound_keywords.insert(keyword);
+        return CsoundOther;
     }
+    if ((state & CsoundLineStates::in_score) != 0)
+        return readScoreToken(source);
+    return readOrchestraToken(source, true);
 }
 
-int CsoundTokeniser::readNextToken(juce::CodeDocument::Iterator& source)
+int CsoundTokeniser::readOrchestraToken(juce::CodeDocument::Iterator& source, bool by_line)
 {
     source.skipWhitespace();
     auto startChar = source.peekNextChar();
@@ -55,18 +95,8 @@ int CsoundTokeniser::readNextToken(juce::CodeDocument::Iterator& source)
         else if (source.peekNextChar() == '*')
         {
             source.skip();
+            readBlockComment(source, by_line);
             result = CsoundComment;
-            bool lastWasStar = false;
-            
-            for (;;)
-            {
-                const juce::juce_wchar c = source.nextChar();
-                
-                if (c == 0 || (c == '/' && lastWasStar))
-                    break;
-                
-                lastWasStar = (c == '*');
-            }
         }
         if (result == CsoundComment)
         {
@@ -75,13 +105,7 @@ int CsoundTokeniser::readNextToken(juce::CodeDocument::Iterator& source)
     }
     // Handle strings
     if (startChar == '"')
-    {
-        source.skip();
-        while (!source.isEOF() && source.peekNextChar() != '"')
-            source.skip();
-        source.skip(); // Skip closing quote
-        return CsoundString;
-    }
+        return readString(source);
     // Handle numbers
     if (juce::CharacterFunctions::isDigit(startChar) || startChar == '.')
     {
@@ -89,14 +113,28 @@ int CsoundTokeniser::readNextToken(juce::CodeDocument::Iterator& source)
             source.skip();
         return CsoundNumber;
     }
-    // Handle identifiers and keywords
+    // Handle identifiers and keywords. The token is scanned into a buffer on
+    // the stack; a token that is too long for it, or is not ASCII, is not a
+    // keyword.
     if (juce::CharacterFunctions::isLetter(startChar))
     {
-        juce::String token;
-        while (juce::CharacterFunctions::isLetterOrDigit(source.peekNextChar()) || source.peekNextChar() == '_')
-            token += source.nextChar();
-        if (csound_keywords.contains(token.toRawUTF8()))
-            return CsoundKeyword;
+        char token[CsoundKeywords::maximum_length];
+        size_t length = 0;
+        bool may_be_keyword = true;
+        for (auto c = source.peekNextChar(); juce::CharacterFunctions::isLetterOrDigit(c) || c == '_'; c = source.peekNextChar())
+        {
+            if (length < sizeof(token) && c < 0x80)
+                token[length++] = char(c);
+            else
+                may_be_keyword = false;
+            source.skip();
+        }
+        if (may_be_keyword)
+        {
+            std::string_view word(token, length);
+            if (opcode_catalogue != nullptr ? opcode_catalogue->contains(word) : csound_keywords.contains(word))
+                return CsoundKeyword;
+        }
         ///if (csoundOpcodes.contains(token))
         ///    return CsoundOpcode;
         return CsoundIdentifier;
@@ -106,6 +144,105 @@ int CsoundTokeniser::readNextToken(juce::CodeDocument::Iterator& source)
     return CsoundOther;
 }
 
+/**
+ * Scores are mostly numbers, so the score lexer distinguishes only
+ * comments, strings, numbers, and statements, and looks up no keywords.
+ */
+int CsoundTokeniser::readScoreToken(juce::CodeDocument::Iterator &source)
+{
+    source.skipWhitespace();
+    auto startChar = source.peekNextChar();
+    if (startChar == ';')
+    {
+        while (!source.isEOF() && source.peekNextChar() != '\n')
+            source.skip();
+        return CsoundComment;
+    }
+    if (startChar == '/')
+    {
+        source.skip();
+        if (source.peekNextChar() == '*')
+        {
+            source.skip();
+            return readBlockComment(source, true);
+        }
+        if (source.peekNextChar() == '/')
+        {
+            source.skipToEndOfLine();
+            return CsoundComment;
+        }
+        return CsoundOther;
+    }
+    if (startChar == '"')
+        return readString(source);
+    if (juce::CharacterFunctions::isDigit(startChar) || startChar == '.' || startChar == '-' || startChar == '+')
+    {
+        source.skip();
+        while (juce::CharacterFunctions::isDigit(source.peekNextChar()) || source.peekNextChar() == '.')
+            source.skip();
+        return CsoundNumber;
+    }
+    if (juce::CharacterFunctions::isLetter(startChar))
+    {
+        while (juce::CharacterFunctions::isLetterOrDigit(source.peekNextChar()) || source.peekNextChar() == '_')
+            source.skip();
+        return CsoundKeyword;
+    }
+    source.skip();
+    return CsoundOther;
+}
+
+int CsoundTokeniser::readBlockComment(juce::CodeDocument::Iterator &source, bool by_line)
+{
+    bool lastWasStar = false;
+    for (;;)
+    {
+        const juce::juce_wchar c = source.nextChar();
+
+        if (c == 0 || (c == '/' && lastWasStar) || (by_line && c == '\n'))
+            break;
+
+        lastWasStar = (c == '*');
+    }
+    return CsoundComment;
+}
+
+/**
+ * Reads a string to its closing quote, or at most to the end of the line.
+ */
+int CsoundTokeniser::readString(juce::CodeDocument::Iterator &source)
+{
+    source.skip();
+    while (!source.isEOF() && source.peekNextChar() != '"' && source.peekNextChar() != '\n')
+    {
+        if (source.nextChar() == '\\' && !source.isEOF() && source.peekNextChar() != '\n')
+            source.skip();
+    }
+    if (source.peekNextChar() == '"')
+        source.skip(); // Skip closing quote
+    return CsoundString;
+}
+
+std::set<std::string> CsoundTokeniser::getIdentifiers(const juce::String &text)
+{
+    std::set<std::string> identifiers;
+    juce::CodeDocument document;
+    document.replaceAllContent(text);
+    juce::CodeDocument::Iterator source(document);
+    while (!source.isEOF())
+    {
+        source.skipWhitespace();
+        auto start = source.getPosition();
+        auto token_type = readOrchestraToken(source, false);
+        if (token_type == CsoundKeyword || token_type == CsoundIdentifier)
+        {
+            auto token = document.getTextBetween(juce::CodeDocument::Position(document, start), juce::CodeDocument::Position(document, source.getPosition()));
+            identifiers.insert(token.toStdString());
+        }
+    }
+    return identifiers;
+}
+
 juce::CodeEditorComponent::ColourScheme CsoundTokeniser::getDefaultColourScheme()
 {
     return csd_color_scheme;
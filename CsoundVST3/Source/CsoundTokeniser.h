@@ -2,6 +2,12 @@
 #include <juce_audio_processors/juce_audio_processors.h>
 #include <juce_audio_utils/juce_audio_utils.h>
 #include <juce_gui_extra/juce_gui_extra.h>
+#include "CsoundLineStates.h"
+#include "OpcodeCatalogue.h"
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
 
 class CsoundTokeniser : public juce::CodeTokeniser
 {
@@ -12,6 +18,25 @@ public:
     int readNextToken(juce::CodeDocument::Iterator& source) override;
     juce::CodeEditorComponent::ColourScheme getDefaultColourScheme() override;
     juce::StringArray virtual getTokenTypes();
+    /**
+     * Tokenises a document incrementally, for an editor of very large csds.
+     * The tokeniser keeps the state at the start of each line of the
+     * document, so that it can begin at any line start; reads lines outside
+     * those that visible_lines returns as single tokens, so that the editor
+     * can skip past them; and reads the score with a simpler lexer that
+     * does not look up keywords.
+     */
+    void attach(juce::CodeDocument &document, std::function<juce::Range<int>()> visible_lines);
+    /**
+     * Returns the identifiers and keywords that this tokeniser finds in the
+     * text, e.g. the opcodes used by an orchestra.
+     */
+    std::set<std::string> getIdentifiers(const juce::String &text);
+    /**
+     * Highlights the names in the catalogue, rather than those in csd_ids,
+     * as keywords. The editor must retokenise its document afterwards.
+     */
+    void setOpcodeCatalogue(const OpcodeCatalogue *catalogue);
     juce::CodeEditorComponent::ColourScheme csd_color_scheme;
 
 private:
@@ -25,6 +50,18 @@ private:
         CsoundIdentifier,
         CsoundOther,
     };
+    int readOrchestraToken(juce::CodeDocument::Iterator &source, bool by_line);
+    int readScoreToken(juce::CodeDocument::Iterator &source);
+    /**
+     * Reads the rest of a block comment, or if by_line, at most the rest of
+     * the line.
+     */
+    static int readBlockComment(juce::CodeDocument::Iterator &source, bool by_line);
+    static int readString(juce::CodeDocument::Iterator &source);
+    juce::CodeDocument *attached_document = nullptr;
+    std::unique_ptr<CsoundLineStates> line_states;
+    std::function<juce::Range<int>()> visible_lines;
+    const OpcodeCatalogue *opcode_catalogue = nullptr;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CsoundTokeniser)
 };
@@ -0,0 +1,239 @@
+#include "Hibernation.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+
+static const char *score_begin_tag = "<CsScore>";
+static const char *score_end_tag = "</CsScore>";
+
+/**
+ * Reads a score time, where "z" is an indefinitely long time. Returns false
+ * if the token is not a plain number.
+ */
+static bool parseScoreTime(const juce::String &token, double &seconds)
+{
+    if (token == "z")
+    {
+        seconds = std::numeric_limits<double>::infinity();
+        return true;
+    }
+    auto text = token.toRawUTF8();
+    char *end = nullptr;
+    seconds = std::strtod(text, &end);
+    return end != text && *end == 0;
+}
+
+/**
+ * Csound sorts the score, so the last event is the one with the latest
+ * start, counting sections from the end of the section before. Without a
+ * tempo statement, beats are seconds. The function table 0 statement only
+ * extends the performance, and so counts only towards the section's end.
+ */
+bool Hibernation::parseScore(const juce::String &csd)
+{
+    last_score_event_seconds = std::numeric_limits<double>::infinity();
+    auto begin = csd.indexOf(score_begin_tag);
+    if (begin == -1)
+    {
+        // The score element may have attributes, such as a score generator.
+        if (csd.contains("<CsScore"))
+        {
+            return false;
+        }
+        last_score_event_seconds = 0;
+        return true;
+    }
+    begin += juce::String(score_begin_tag).length();
+    auto end = csd.indexOf(begin, score_end_tag);
+    if (end == -1)
+    {
+        return false;
+    }
+    auto score = csd.substring(begin, end);
+    for (auto comment = score.indexOf("/*"); comment != -1; comment = score.indexOf(comment, "/*"))
+    {
+        auto comment_end = score.indexOf(comment + 2, "*/");
+        score = score.replaceSection(comment, comment_end == -1 ? score.length() - comment : comment_end + 2 - comment, " ");
+    }
+    juce::StringArray lines;
+    lines.addLines(score);
+    double last_event = 0;
+    double section_begin = 0;
+    double section_end = 0;
+    double prior_start = 0;
+    double prior_duration = 0;
+    for (auto line : lines)
+    {
+        line = line.upToFirstOccurrenceOf(";", false, false).upToFirstOccurrenceOf("//", false, false).trim();
+        if (line.isEmpty())
+        {
+            continue;
+        }
+        auto statement = line[0];
+        juce::StringArray pfields;
+        pfields.addTokens(line.substring(1), " \t", "\"");
+        pfields.removeEmptyStrings();
+        if (statement == 'e')
+        {
+            break;
+        }
+        if (statement == 's')
+        {
+            section_begin += section_end;
+            section_end = 0;
+            continue;
+        }
+        if (statement == 'f')
+        {
+            double start;
+            if (pfields.size() < 2 || !parseScoreTime(pfields[1], start))
+            {
+                return false;
+            }
+            section_end = std::max(section_end, start);
+            if (pfields[0].getIntValue() != 0)
+            {
+                last_event = std::max(last_event, section_begin + start);
+            }
+            continue;
+        }
+        if (statement != 'i')
+        {
+            return false;
+        }
+        // Missing or "." times are carried from the prior note, and a start
+        // of "+" follows the prior note.
+        auto start = prior_start;
+        auto duration = prior_duration;
+        if (pfields.size() > 1 && pfields[1] != ".")
+        {
+            if (pfields[1] == "+")
+            {
+                start = prior_start + std::max(prior_duration, 0.);
+            }
+            else if (!parseScoreTime(pfields[1], start))
+            {
+                return false;
+            }
+        }
+        if (pfields.size() > 2 && pfields[2] != "." && !parseScoreTime(pfields[2], duration))
+        {
+            return false;
+        }
+        prior_start = start;
+        prior_duration = duration;
+        last_event = std::max(last_event, section_begin + start);
+        section_end = std::max(section_end, start + std::max(duration, 0.));
+    }
+    last_score_event_seconds = last_event;
+    return std::isfinite(last_event);
+}
+
+void Hibernation::prepare(double sample_rate, double tail_seconds)
+{
+    tail_frames = tail_seconds > 0. ? int64_t(sample_rate * tail_seconds) : 0;
+    silent_frames = 0;
+    hibernating = false;
+    transport_playing = false;
+    expected_host_frame = -1;
+    for (auto &notes : held_notes)
+    {
+        notes.reset();
+    }
+    sustained_channels.reset();
+}
+
+void Hibernation::observeMidi(const juce::MidiMessage &message)
+{
+    auto channel = size_t(message.getChannel() - 1);
+    if (channel >= held_notes.size())
+    {
+        return;
+    }
+    if (message.isNoteOn())
+    {
+        held_notes[channel].set(size_t(message.getNoteNumber()));
+    }
+    else if (message.isNoteOff())
+    {
+        held_notes[channel].reset(size_t(message.getNoteNumber()));
+    }
+    else if (message.isSustainPedalOn())
+    {
+        sustained_channels.set(channel);
+    }
+    else if (message.isSustainPedalOff())
+    {
+        sustained_channels.reset(channel);
+    }
+    else if (message.isAllNotesOff() || message.isAllSoundOff())
+    {
+        held_notes[channel].reset();
+    }
+    wake();
+}
+
+void Hibernation::observeInput(float peak)
+{
+    if (peak > silence_threshold)
+    {
+        wake();
+    }
+}
+
+void Hibernation::observeTransport(bool playing, int64_t host_frame)
+{
+    // Waking when the transport starts, stops, or jumps lets the score and
+    // any tempo-synchronized instruments follow the host.
+    if (playing != transport_playing || (playing && host_frame != expected_host_frame))
+    {
+        wake();
+    }
+    transport_playing = playing;
+    expected_host_frame = host_frame;
+}
+
+void Hibernation::observeOutput(float peak, int frames, double score_seconds, int active_voices)
+{
+    if (transport_playing)
+    {
+        expected_host_frame += frames;
+    }
+    if (peak > silence_threshold || isHoldingNotes() || active_voices > 0 || score_seconds <= last_score_event_seconds)
+    {
+        silent_frames = 0;
+        return;
+    }
+    silent_frames += frames;
+    if (tail_frames > 0 && silent_frames >= tail_frames)
+    {
+        hibernating = true;
+    }
+}
+
+void Hibernation::sleep(int frames)
+{
+    if (transport_playing)
+    {
+        expected_host_frame += frames;
+    }
+}
+
+void Hibernation::wake()
+{
+    silent_frames = 0;
+    hibernating = false;
+}
+
+bool Hibernation::isHoldingNotes() const
+{
+    for (size_t channel = 0; channel < held_notes.size(); ++channel)
+    {
+        if (held_notes[channel].any() || sustained_channels.test(channel))
+        {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <array>
+#include <bitset>
+#include <cstdint>
+
+/**
+ * Decides when an idle plugin instance may stop rendering.
+ *
+ * The instance hibernates once no MIDI notes are held, Csound reports no
+ * active voices, the score has no events left to start, and the output
+ * has stayed below the silence threshold for the tail time. While it
+ * hibernates, processBlock does not call Csound at all, and returns a
+ * cleared buffer; Csound's clock stops, and resumes where it stopped. It
+ * wakes on any MIDI channel message, on audio input above the threshold,
+ * or when the host starts or relocates its transport.
+ *
+ * Held notes are tracked from the MIDI stream, including the sustain
+ * pedal. Voices that outlast their notes, such as release tails and
+ * delays, are covered by the active voices that the csd reports, if it
+ * does, and otherwise by the tail time. Events that the orchestra
+ * schedules for later, rather than the score, are not seen.
+ */
+class Hibernation
+{
+public:
+    /**
+     * About -90 dBFS.
+     */
+    static constexpr float silence_threshold = 3.0e-5f;
+    /**
+     * Resets the state; a tail of 0 seconds disables hibernation.
+     */
+    void prepare(double sample_rate, double tail_seconds);
+    /**
+     * Reads the start time of the last event in the csd's score, so that
+     * the instance does not hibernate before Csound's score reaches it.
+     * Returns false if the score uses statements whose times are not read
+     * here, such as tempo, loops, or macros, in which case the instance
+     * never hibernates.
+     */
+    bool parseScore(const juce::String &csd);
+    bool isEnabled() const
+    {
+        return tail_frames > 0;
+    }
+    void observeMidi(const juce::MidiMessage &message);
+    void observeInput(float peak);
+    void observeTransport(bool playing, int64_t host_frame);
+    /**
+     * Called after a block has been rendered, with the peak of Csound's
+     * output, Csound's score time, and the number of voices that Csound
+     * reports active.
+     */
+    void observeOutput(float peak, int frames, double score_seconds, int active_voices);
+    /**
+     * Called instead of rendering a block while hibernating.
+     */
+    void sleep(int frames);
+    bool isHibernating() const
+    {
+        return hibernating;
+    }
+
+private:
+    void wake();
+    bool isHoldingNotes() const;
+    int64_t tail_frames = 0;
+    int64_t silent_frames = 0;
+    bool hibernating = false;
+    bool transport_playing = false;
+    int64_t expected_host_frame = -1;
+    double last_score_event_seconds = 0;
+    std::array<std::bitset<128>, 16> held_notes {};
+    std::bitset<16> sustained_channels {};
+};
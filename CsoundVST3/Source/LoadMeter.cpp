@@ -0,0 +1,81 @@
+#include "LoadMeter.h"
+
+#include <algorithm>
+
+LoadMeter::LoadMeter()
+{
+    prepare(48000.);
+}
+
+void LoadMeter::prepare(double sample_rate)
+{
+    frames_per_tick = sample_rate / double(juce::Time::getHighResolutionTicksPerSecond());
+    for (auto &meter : meters)
+    {
+        meter.current = 0;
+        meter.peak = 0;
+        meter.xruns = 0;
+        for (auto &bucket : meter.histogram)
+        {
+            bucket = 0;
+        }
+    }
+}
+
+/**
+ * Only one thread at a time writes a meter, so its peak needs no
+ * compare-and-swap loop, and relaxed ordering suffices. In pipelined mode,
+ * the block meter is written by whichever render thread renders the
+ * block, after the previous block's render has finished.
+ */
+void LoadMeter::record(Kind kind, int64_t ticks, int frames)
+{
+    if (frames <= 0)
+    {
+        return;
+    }
+    auto &meter = meters[size_t(kind)];
+    auto load = float(double(ticks) * frames_per_tick.load(std::memory_order_relaxed) / double(frames));
+    meter.current.store(load, std::memory_order_relaxed);
+    if (load > meter.peak.load(std::memory_order_relaxed))
+    {
+        meter.peak.store(load, std::memory_order_relaxed);
+    }
+    if (load > 1.f)
+    {
+        meter.xruns.fetch_add(1, std::memory_order_relaxed);
+    }
+    auto bucket = std::clamp(int(load * float(bucket_count / maximum_load)), 0, bucket_count - 1);
+    meter.histogram[size_t(bucket)].fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * The 99th percentile is the upper edge of the bucket that contains it, so
+ * it is accurate to 1 / 32 of the budget.
+ */
+LoadMeter::Statistics LoadMeter::getStatistics(Kind kind) const
+{
+    const auto &meter = meters[size_t(kind)];
+    Statistics statistics;
+    statistics.current = meter.current.load(std::memory_order_relaxed);
+    statistics.peak = meter.peak.load(std::memory_order_relaxed);
+    statistics.xruns = meter.xruns.load(std::memory_order_relaxed);
+    std::array<uint32_t, bucket_count> counts;
+    for (int bucket = 0; bucket < bucket_count; ++bucket)
+    {
+        counts[size_t(bucket)] = meter.histogram[size_t(bucket)].load(std::memory_order_relaxed);
+        statistics.count += counts[size_t(bucket)];
+    }
+    auto above = statistics.count / 100;
+    int64_t counted = 0;
+    for (int bucket = bucket_count - 1; bucket >= 0; --bucket)
+    {
+        counted += counts[size_t(bucket)];
+        if (counted > above)
+        {
+            statistics.p99 = (bucket + 1) * maximum_load / bucket_count;
+            break;
+        }
+    }
+    return statistics;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Measures the DSP load: the time that processBlock, and each kperiod of
+ * Csound, takes as a fraction of the real time that its audio lasts. A
+ * load above 1 is an xrun, a missed deadline.
+ *
+ * Intervals are timed with the high resolution tick counter, which is a
+ * monotonic clock that is cheap to read. Each kind of interval has its own
+ * meter, which is written by one thread at a time, without locks; the editor
+ * reads the meters at any time. The loads since prepare are counted in a
+ * histogram, from which the 99th percentile is read.
+ */
+class LoadMeter
+{
+public:
+    enum Kind
+    {
+        BLOCK = 0,
+        KPERIOD,
+        KIND_COUNT,
+    };
+    /**
+     * The histogram's buckets span loads from 0 to 2; the last bucket
+     * also counts every greater load.
+     */
+    static constexpr int bucket_count = 64;
+    static constexpr double maximum_load = 2.;
+    struct Statistics
+    {
+        double current = 0;
+        double peak = 0;
+        double p99 = 0;
+        int64_t xruns = 0;
+        int64_t count = 0;
+    };
+    /**
+     * Times one interval, from construction to destruction.
+     */
+    class ScopedTimer
+    {
+    public:
+        ScopedTimer(LoadMeter &meter_, Kind kind_, int frames_)
+            : meter(meter_), kind(kind_), frames(frames_), begin(juce::Time::getHighResolutionTicks())
+        {
+        }
+        ~ScopedTimer()
+        {
+            if (!released)
+            {
+                meter.record(kind, juce::Time::getHighResolutionTicks() - begin, frames);
+            }
+        }
+        /**
+         * Stops timing without recording, and returns the ticks so far, for
+         * another thread to record with the rest of the interval.
+         */
+        int64_t release()
+        {
+            released = true;
+            return juce::Time::getHighResolutionTicks() - begin;
+        }
+
+    private:
+        LoadMeter &meter;
+        Kind kind;
+        int frames;
+        int64_t begin;
+        bool released = false;
+    };
+    LoadMeter();
+    /**
+     * Sets the real-time budget, and clears the meters.
+     */
+    void prepare(double sample_rate);
+    /**
+     * Records an interval of ticks that processed frames of audio.
+     */
+    void record(Kind kind, int64_t ticks, int frames);
+    Statistics getStatistics(Kind kind) const;
+
+private:
+    struct Meter
+    {
+        std::atomic<float> current {0};
+        std::atomic<float> peak {0};
+        std::atomic<int64_t> xruns {0};
+        std::array<std::atomic<uint32_t>, bucket_count> histogram {};
+    };
+    std::atomic<double> frames_per_tick {0};
+    std::array<Meter, KIND_COUNT> meters;
+};
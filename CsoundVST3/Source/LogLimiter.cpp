@@ -0,0 +1,146 @@
+#include "LogLimiter.h"
+
+#include <juce_core/juce_core.h>
+#include <cstdio>
+
+/**
+ * The Csound message type, from the CSOUNDMSG_TYPE_MASK bits of the level.
+ */
+static int message_type(int32_t level)
+{
+    return (level & 0x7000) >> 12;
+}
+
+static uint64_t hash_message(const char *text, size_t length)
+{
+    uint64_t result = 0xcbf29ce484222325ull;
+    for (size_t index = 0; index < length; ++index)
+    {
+        result ^= uint8_t(text[index]);
+        result *= 0x100000001b3ull;
+    }
+    return result;
+}
+
+LogLimiter::LogLimiter()
+{
+    ticks_per_second = double(juce::Time::getHighResolutionTicksPerSecond());
+    reset();
+}
+
+void LogLimiter::reset()
+{
+    while (tryLock() == false)
+    {
+    }
+    last_hash = 0;
+    repeats = 0;
+    for (auto &bucket : buckets)
+    {
+        bucket = { burst_messages, juce::Time::getHighResolutionTicks(), 0 };
+    }
+    repeated_total = 0;
+    suppressed_total = 0;
+    unlock();
+}
+
+void LogLimiter::write(LogRing &ring, int32_t level, int16_t source, int64_t timestamp, const char *text, size_t length, bool was_truncated)
+{
+    if (tryLock() == false)
+    {
+        ring.write(level, source, timestamp, text, length, was_truncated);
+        return;
+    }
+    auto hash = hash_message(text, length);
+    if (hash == last_hash && level == last_level && source == last_source)
+    {
+        repeats++;
+        repeated_total++;
+        unlock();
+        return;
+    }
+    writeRepeats(ring, timestamp);
+    last_hash = hash;
+    last_level = level;
+    last_source = source;
+    auto type = message_type(level);
+    auto &bucket = buckets[size_t(type)];
+    refill(bucket, timestamp);
+    if (bucket.tokens < 1.)
+    {
+        bucket.suppressed++;
+        suppressed_total++;
+        unlock();
+        return;
+    }
+    bucket.tokens -= 1.;
+    writeSuppressed(ring, bucket, type, timestamp);
+    ring.write(level, source, timestamp, text, length, was_truncated);
+    unlock();
+}
+
+void LogLimiter::flush(LogRing &ring, int64_t timestamp)
+{
+    if (tryLock() == false)
+    {
+        return;
+    }
+    writeRepeats(ring, timestamp);
+    // A repeat after a flush is reported again, so that continuing
+    // repetition stays visible.
+    last_hash = 0;
+    for (int type = 0; type < message_types; ++type)
+    {
+        auto &bucket = buckets[size_t(type)];
+        refill(bucket, timestamp);
+        if (bucket.tokens >= 1.)
+        {
+            writeSuppressed(ring, bucket, type, timestamp);
+        }
+    }
+    unlock();
+}
+
+bool LogLimiter::tryLock()
+{
+    return lock.test_and_set(std::memory_order_acquire) == false;
+}
+
+void LogLimiter::unlock()
+{
+    lock.clear(std::memory_order_release);
+}
+
+void LogLimiter::writeRepeats(LogRing &ring, int64_t timestamp)
+{
+    if (repeats == 0)
+    {
+        return;
+    }
+    char buffer[64];
+    auto length = std::snprintf(buffer, sizeof(buffer), "(repeated %lld times)\n", (long long)repeats);
+    ring.write(last_level, last_source, timestamp, buffer, size_t(length));
+    repeats = 0;
+}
+
+void LogLimiter::writeSuppressed(LogRing &ring, Bucket &bucket, int type, int64_t timestamp)
+{
+    if (bucket.suppressed == 0)
+    {
+        return;
+    }
+    char buffer[64];
+    auto length = std::snprintf(buffer, sizeof(buffer), "(%lld messages suppressed)\n", (long long)bucket.suppressed);
+    ring.write(type << 12, 0, timestamp, buffer, size_t(length));
+    bucket.suppressed = 0;
+}
+
+void LogLimiter::refill(Bucket &bucket, int64_t timestamp)
+{
+    if (timestamp <= bucket.refilled)
+    {
+        return;
+    }
+    bucket.tokens = std::min(burst_messages, bucket.tokens + (timestamp - bucket.refilled) * messages_per_second / ticks_per_second);
+    bucket.refilled = timestamp;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "LogRing.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Keeps repetitive Csound output, such as printk every kperiod or samples
+ * out of range, from flooding the log ring and the message log.
+ *
+ * A message identical to the one before it, with the same level and
+ * source, is not written but counted, and a "(repeated N times)" record
+ * is written when a different message arrives or when the log is flushed.
+ * Each Csound message type (errors, warnings, orchestra output, and so
+ * on) has its own token bucket: messages beyond its rate are suppressed and
+ * counted, and a "(N messages suppressed)" record is written once the
+ * bucket refills.
+ *
+ * Writers take a try-lock; a writer that finds it taken writes its message
+ * unlimited rather than wait, so that the limiter never blocks.
+ */
+class LogLimiter
+{
+public:
+    static constexpr int message_types = 8;
+    static constexpr double messages_per_second = 100.;
+    static constexpr double burst_messages = 1000.;
+    LogLimiter();
+    /**
+     * Writes length bytes of text; was_truncated is passed on to the ring.
+     */
+    void write(LogRing &ring, int32_t level, int16_t source, int64_t timestamp, const char *text, size_t length, bool was_truncated = false);
+    /**
+     * Writes any pending repeat and suppression counts.
+     */
+    void flush(LogRing &ring, int64_t timestamp);
+    void reset();
+    int64_t getRepeatedCount() const
+    {
+        return repeated_total;
+    }
+    int64_t getSuppressedCount() const
+    {
+        return suppressed_total;
+    }
+
+private:
+    struct Bucket
+    {
+        double tokens;
+        int64_t refilled;
+        int64_t suppressed;
+    };
+    bool tryLock();
+    void unlock();
+    void writeRepeats(LogRing &ring, int64_t timestamp);
+    void writeSuppressed(LogRing &ring, Bucket &bucket, int type, int64_t timestamp);
+    void refill(Bucket &bucket, int64_t timestamp);
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    double ticks_per_second;
+    uint64_t last_hash = 0;
+    int32_t last_level = 0;
+    int16_t last_source = 0;
+    int64_t repeats = 0;
+    std::array<Bucket, message_types> buckets {};
+    std::atomic<int64_t> repeated_total {0};
+    std::atomic<int64_t> suppressed_total {0};
+};
@@ -0,0 +1,75 @@
+#include "LogRing.h"
+#include <algorithm>
+
+static_assert(sizeof(LogRing::Header) == 24, "LogRing::Header must be 24 bytes.");
+
+static size_t round_up_to_power_of_2(size_t value)
+{
+    size_t result = 1;
+    while (result < value)
+    {
+        result <<= 1;
+    }
+    return result;
+}
+
+LogRing::LogRing(size_t capacity_bytes)
+{
+    auto capacity = round_up_to_power_of_2(std::max(capacity_bytes, 4 * (sizeof(Header) + maximum_text_bytes)));
+    storage = std::make_unique<uint64_t[]>(capacity / sizeof(uint64_t));
+    bytes = reinterpret_cast<uint8_t *>(storage.get());
+    mask = capacity - 1;
+}
+
+bool LogRing::write(int32_t level, int16_t source, int64_t timestamp, const char *text, size_t length, bool was_truncated)
+{
+    uint16_t flags = 0;
+    if (length > maximum_text_bytes || was_truncated)
+    {
+        length = std::min(length, maximum_text_bytes);
+        flags |= truncated_flag;
+        truncated++;
+    }
+    const uint64_t size = (sizeof(Header) + length + 7) & ~uint64_t(7);
+    const uint64_t capacity = mask + 1;
+    uint64_t position = write_position.load(std::memory_order_relaxed);
+    uint64_t padding = 0;
+    while (true)
+    {
+        // A record that would cross the end of the ring starts at the
+        // beginning instead, after padding.
+        auto contiguous = capacity - (position & mask);
+        padding = contiguous < size ? contiguous : 0;
+        if (position + padding + size - read_position.load(std::memory_order_acquire) > capacity)
+        {
+            dropped++;
+            return false;
+        }
+        if (write_position.compare_exchange_weak(position, position + padding + size, std::memory_order_relaxed))
+        {
+            break;
+        }
+    }
+    if (padding != 0)
+    {
+        std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t *>(bytes + (position & mask))).store(uint32_t(padding) | padding_flag, std::memory_order_release);
+        position += padding;
+    }
+    auto record = bytes + (position & mask);
+    Header header { 0, level, timestamp, uint32_t(length), source, flags };
+    std::memcpy(record + sizeof(header.word), reinterpret_cast<const uint8_t *>(&header) + sizeof(header.word), sizeof(Header) - sizeof(header.word));
+    std::memcpy(record + sizeof(Header), text, length);
+    std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t *>(record)).store(uint32_t(size), std::memory_order_release);
+    return true;
+}
+
+void LogRing::discard()
+{
+    read([](const Header &, const char *) {});
+}
+
+void LogRing::resetCounts()
+{
+    dropped = 0;
+    truncated = 0;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+/**
+ * A preallocated, lock-free ring of log records, written by any number of
+ * threads, including the audio thread and the RenderThreadPool, and read by
+ * one thread, the editor's timer.
+ *
+ * Each record is a header followed by the message text, padded to 8 bytes
+ * and never split across the end of the ring. A writer reserves space with
+ * one compare-and-swap, copies in its record, and publishes it with one
+ * atomic store. Writing never blocks or allocates: text longer than
+ * maximum_text_bytes is truncated, and records that do not fit in the ring
+ * are dropped; both are counted.
+ */
+class LogRing
+{
+public:
+    static constexpr size_t maximum_text_bytes = 1024;
+    struct Header
+    {
+        /**
+         * The size of the record in bytes, with padding_flag set for
+         * padding at the end of the ring; 0 until the record is published.
+         */
+        uint32_t word;
+        /**
+         * The Csound message attributes, or 0 for plugin messages.
+         */
+        int32_t level;
+        /**
+         * From juce::Time::getHighResolutionTicks.
+         */
+        int64_t timestamp;
+        uint32_t length;
+        /**
+         * The shard that wrote the record.
+         */
+        int16_t source;
+        uint16_t flags;
+    };
+    static constexpr uint32_t padding_flag = 0x80000000u;
+    static constexpr uint16_t truncated_flag = 1;
+    /**
+     * The capacity is rounded up to a power of 2.
+     */
+    explicit LogRing(size_t capacity_bytes);
+    /**
+     * Writes a record; returns false if it was dropped. Text longer than
+     * maximum_text_bytes is truncated; was_truncated marks text that the
+     * writer has already cut short.
+     */
+    bool write(int32_t level, int16_t source, int64_t timestamp, const char *text, size_t length, bool was_truncated = false);
+    /**
+     * Calls function(const Header &, const char *text) for up to
+     * maximum_records published records, in order, and removes them.
+     * Returns the number of records read. Must only be called by the
+     * reading thread.
+     */
+    template<typename Function> int read(Function function, int maximum_records = 0x7fffffff)
+    {
+        int records = 0;
+        auto position = read_position.load(std::memory_order_relaxed);
+        while (records < maximum_records)
+        {
+            auto record = bytes + (position & mask);
+            auto word = std::atomic_ref<uint32_t>(*reinterpret_cast<uint32_t *>(record)).load(std::memory_order_acquire);
+            if (word == 0)
+            {
+                break;
+            }
+            auto size = word & ~padding_flag;
+            if ((word & padding_flag) == 0)
+            {
+                Header header;
+                std::memcpy(&header, record, sizeof(Header));
+                function(header, reinterpret_cast<const char *>(record + sizeof(Header)));
+                ++records;
+            }
+            // Writers expect free space to be zeroed.
+            std::memset(record, 0, size);
+            position += size;
+            read_position.store(position, std::memory_order_release);
+        }
+        return records;
+    }
+    /**
+     * Removes all published records. Must only be called by the reading
+     * thread.
+     */
+    void discard();
+    size_t getCapacity() const
+    {
+        return mask + 1;
+    }
+    int64_t getDroppedCount() const
+    {
+        return dropped;
+    }
+    int64_t getTruncatedCount() const
+    {
+        return truncated;
+    }
+    void resetCounts();
+
+private:
+    std::unique_ptr<uint64_t[]> storage;
+    uint8_t *bytes;
+    size_t mask;
+    alignas(64) std::atomic<uint64_t> write_position {0};
+    alignas(64) std::atomic<uint64_t> read_position {0};
+    std::atomic<int64_t> dropped {0};
+    std::atomic<int64_t> truncated {0};
+};
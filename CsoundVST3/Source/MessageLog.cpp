@@ -0,0 +1,339 @@
+#include "MessageLog.h"
+
+MessageLog::MessageLog()
+{
+    lines.resize(size_t(default_line_cap));
+}
+
+int MessageLog::append(const juce::String &text)
+{
+    int evicted = 0;
+    auto p = text.getCharPointer();
+    while (!p.isEmpty())
+    {
+        auto begin = p;
+        while (!p.isEmpty() && *p != '\n')
+        {
+            ++p;
+        }
+        auto piece = juce::String(begin, p).trimCharactersAtEnd("\r");
+        auto ended = !p.isEmpty();
+        if (ended)
+        {
+            ++p;
+        }
+        int64_t sequence;
+        if (last_line_open)
+        {
+            sequence = end_line - 1;
+            getLine(sequence) += piece;
+            // A line that matched still matches after it is continued.
+            if (filter.isNotEmpty() && (matching_lines.empty() || matching_lines.back() != sequence) && matches(getLine(sequence)))
+            {
+                matching_lines.push_back(sequence);
+            }
+        }
+        else
+        {
+            if (end_line - first_line == int64_t(lines.size()))
+            {
+                evicted += evict();
+            }
+            sequence = end_line++;
+            getLine(sequence) = piece;
+            if (filter.isNotEmpty() && matches(piece))
+            {
+                matching_lines.push_back(sequence);
+            }
+        }
+        longest_line = std::max(longest_line, getLine(sequence).length());
+        last_line_open = !ended;
+    }
+    return evicted;
+}
+
+void MessageLog::clear()
+{
+    std::fill(lines.begin(), lines.end(), juce::String());
+    first_line = 0;
+    end_line = 0;
+    last_line_open = false;
+    matching_lines.clear();
+    longest_line = 0;
+}
+
+void MessageLog::setLineCap(int cap)
+{
+    cap = juce::jlimit(minimum_line_cap, maximum_line_cap, cap);
+    if (size_t(cap) == lines.size())
+    {
+        return;
+    }
+    std::vector<juce::String> resized_lines(size_t(cap));
+    auto kept_first_line = std::max(first_line, end_line - cap);
+    for (auto sequence = kept_first_line; sequence < end_line; ++sequence)
+    {
+        resized_lines[size_t(sequence % cap)] = std::move(getLine(sequence));
+    }
+    lines.swap(resized_lines);
+    first_line = kept_first_line;
+    while (!matching_lines.empty() && matching_lines.front() < first_line)
+    {
+        matching_lines.pop_front();
+    }
+}
+
+int MessageLog::getLineCap() const
+{
+    return int(lines.size());
+}
+
+void MessageLog::setFilter(const juce::String &new_filter)
+{
+    filter = new_filter;
+    matching_lines.clear();
+    if (filter.isEmpty())
+    {
+        return;
+    }
+    for (auto sequence = first_line; sequence < end_line; ++sequence)
+    {
+        if (matches(getLine(sequence)))
+        {
+            matching_lines.push_back(sequence);
+        }
+    }
+}
+
+const juce::String &MessageLog::getFilter() const
+{
+    return filter;
+}
+
+int MessageLog::getRowCount() const
+{
+    if (filter.isEmpty())
+    {
+        return int(end_line - first_line);
+    }
+    return int(matching_lines.size());
+}
+
+const juce::String &MessageLog::getRow(int row) const
+{
+    if (filter.isEmpty())
+    {
+        return getLine(first_line + row);
+    }
+    return getLine(matching_lines[size_t(row)]);
+}
+
+int MessageLog::getLineCount() const
+{
+    return int(end_line - first_line);
+}
+
+int MessageLog::getLongestLine() const
+{
+    return longest_line;
+}
+
+juce::String &MessageLog::getLine(int64_t sequence)
+{
+    return lines[size_t(sequence % int64_t(lines.size()))];
+}
+
+const juce::String &MessageLog::getLine(int64_t sequence) const
+{
+    return lines[size_t(sequence % int64_t(lines.size()))];
+}
+
+bool MessageLog::matches(const juce::String &line) const
+{
+    return line.containsIgnoreCase(filter);
+}
+
+/**
+ * Evicts the oldest line, and returns 1 if it was a row or else 0.
+ */
+int MessageLog::evict()
+{
+    getLine(first_line) = juce::String();
+    auto row = filter.isEmpty();
+    if (!matching_lines.empty() && matching_lines.front() == first_line)
+    {
+        matching_lines.pop_front();
+        row = true;
+    }
+    ++first_line;
+    return row ? 1 : 0;
+}
+
+//==============================================================================
+MessageLogView::MessageLogView()
+    : font(juce::Font::getDefaultMonospacedFontName(), 14.0f, juce::Font::plain),
+    listBox("Messages", this)
+{
+    char_width = font.getStringWidthFloat("M");
+
+    addAndMakeVisible(searchEditor);
+    searchEditor.setTextToShowWhenEmpty("Search messages", juce::Colours::grey);
+    searchEditor.setTooltip("Show only the messages that contain this text");
+    searchEditor.onTextChange = [this]
+    {
+        log.setFilter(searchEditor.getText());
+        listBox.deselectAllRows();
+        updateContent(true);
+    };
+    searchEditor.onEscapeKey = [this]
+    {
+        searchEditor.setText("");
+    };
+
+    addAndMakeVisible(countLabel);
+    countLabel.setJustificationType(juce::Justification::centredRight);
+
+    addAndMakeVisible(listBox);
+    listBox.setRowHeight(int(std::ceil(font.getHeight())) + 2);
+    listBox.setMultipleSelectionEnabled(true);
+    listBox.setColour(juce::ListBox::backgroundColourId, juce::Colours::black);
+    updateCount();
+}
+
+void MessageLogView::append(const juce::String &text)
+{
+    auto follow = isScrolledToEnd();
+    auto evicted = log.append(text);
+    if (evicted > 0)
+    {
+        listBox.deselectAllRows();
+        if (!follow)
+        {
+            // Keeps the rows in view still while older rows are evicted.
+            auto viewport = listBox.getViewport();
+            viewport->setViewPosition(viewport->getViewPositionX(),
+                std::max(0, viewport->getViewPositionY() - evicted * listBox.getRowHeight()));
+        }
+    }
+    updateContent(follow);
+}
+
+void MessageLogView::clear()
+{
+    log.clear();
+    listBox.deselectAllRows();
+    updateContent(true);
+}
+
+void MessageLogView::setLineCap(int cap)
+{
+    if (cap != log.getLineCap())
+    {
+        log.setLineCap(cap);
+        listBox.deselectAllRows();
+        updateContent(isScrolledToEnd());
+    }
+}
+
+void MessageLogView::resized()
+{
+    auto bounds = getLocalBounds();
+    auto bar = bounds.removeFromTop(24);
+    countLabel.setBounds(bar.removeFromRight(160));
+    searchEditor.setBounds(bar);
+    listBox.setBounds(bounds);
+}
+
+bool MessageLogView::keyPressed(const juce::KeyPress &key)
+{
+    if (key == juce::KeyPress('c', juce::ModifierKeys::commandModifier, 0))
+    {
+        juce::String text;
+        auto rows = listBox.getSelectedRows();
+        for (int index = 0; index < rows.size(); ++index)
+        {
+            if (rows[index] < log.getRowCount())
+            {
+                text << log.getRow(rows[index]) << "\n";
+            }
+        }
+        if (text.isNotEmpty())
+        {
+            juce::SystemClipboard::copyTextToClipboard(text);
+        }
+        return true;
+    }
+    if (key == juce::KeyPress('f', juce::ModifierKeys::commandModifier, 0))
+    {
+        searchEditor.grabKeyboardFocus();
+        return true;
+    }
+    return false;
+}
+
+int MessageLogView::getNumRows()
+{
+    return log.getRowCount();
+}
+
+void MessageLogView::paintListBoxItem(int row, juce::Graphics &g, int width, int height, bool selected)
+{
+    if (row < 0 || row >= log.getRowCount())
+    {
+        return;
+    }
+    if (selected)
+    {
+        g.fillAll(juce::Colours::darkslategrey);
+    }
+    const auto &line = log.getRow(row);
+    const auto &filter = log.getFilter();
+    if (filter.isNotEmpty())
+    {
+        g.setColour(juce::Colours::darkgoldenrod);
+        auto filter_length = filter.length();
+        for (auto index = line.indexOfIgnoreCase(filter); index >= 0; index = line.indexOfIgnoreCase(index + filter_length, filter))
+        {
+            g.fillRect(2.f + index * char_width, 0.f, filter_length * char_width, float(height));
+        }
+    }
+    g.setFont(font);
+    g.setColour(juce::Colours::lightgreen);
+    g.drawText(line, 2, 0, width - 2, height, juce::Justification::centredLeft, false);
+}
+
+bool MessageLogView::isScrolledToEnd()
+{
+    auto viewport = listBox.getViewport();
+    auto content = viewport->getViewedComponent();
+    return content == nullptr || viewport->getViewPositionY() + viewport->getViewHeight() >= content->getHeight() - listBox.getRowHeight();
+}
+
+/**
+ * Updates the list box once for all the changes since the last update. Rows
+ * are repainted even if their number has not changed, because eviction
+ * shifts lines between rows.
+ */
+void MessageLogView::updateContent(bool scroll_to_end)
+{
+    listBox.setMinimumContentWidth(int(log.getLongestLine() * char_width) + 4);
+    listBox.updateContent();
+    if (scroll_to_end && log.getRowCount() > 0)
+    {
+        listBox.scrollToEnsureRowIsOnscreen(log.getRowCount() - 1);
+    }
+    listBox.repaint();
+    updateCount();
+}
+
+void MessageLogView::updateCount()
+{
+    if (log.getFilter().isEmpty())
+    {
+        countLabel.setText(juce::String(log.getLineCount()) + " lines", juce::dontSendNotification);
+    }
+    else
+    {
+        countLabel.setText(juce::String::formatted("%d of %d lines", log.getRowCount(), log.getLineCount()), juce::dontSendNotification);
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <juce_gui_basics/juce_gui_basics.h>
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/**
+ * Holds the most recent lines of Csound output in a ring of at most
+ * line_cap lines, so that a long session with a chatty orchestra uses
+ * bounded memory. Lines are numbered by a sequence that counts every line
+ * ever appended, so that a line keeps its number while older lines are
+ * evicted.
+ *
+ * The log can be filtered by a case-insensitive search string, in which
+ * case its rows are only the lines that contain that string. Matches are
+ * found as lines are appended, not when they are shown.
+ */
+class MessageLog
+{
+public:
+    static constexpr int default_line_cap = 10000;
+    static constexpr int minimum_line_cap = 100;
+    static constexpr int maximum_line_cap = 1000000;
+    MessageLog();
+    /**
+     * Appends text that may contain many lines. Text after the last newline
+     * remains an open line, which the next append continues. Returns the
+     * number of rows evicted from the start of the log.
+     */
+    int append(const juce::String &text);
+    void clear();
+    /**
+     * Changes the line cap, keeping the newest lines.
+     */
+    void setLineCap(int cap);
+    int getLineCap() const;
+    void setFilter(const juce::String &filter);
+    const juce::String &getFilter() const;
+    /**
+     * Returns the number of rows, that is, of lines that match the filter.
+     */
+    int getRowCount() const;
+    const juce::String &getRow(int row) const;
+    /**
+     * Returns the number of lines held, whether or not they match.
+     */
+    int getLineCount() const;
+    /**
+     * Returns the length in characters of the longest line appended since
+     * the log was cleared.
+     */
+    int getLongestLine() const;
+
+private:
+    juce::String &getLine(int64_t sequence);
+    const juce::String &getLine(int64_t sequence) const;
+    bool matches(const juce::String &line) const;
+    int evict();
+    std::vector<juce::String> lines;
+    int64_t first_line = 0;
+    int64_t end_line = 0;
+    bool last_line_open = false;
+    juce::String filter;
+    std::deque<int64_t> matching_lines;
+    int longest_line = 0;
+};
+
+/**
+ * Shows a MessageLog in a list box, which paints only the visible rows, with
+ * a search field that filters the log and highlights what it finds. The view
+ * follows new output while it is scrolled to the end.
+ */
+class MessageLogView : public juce::Component,
+private juce::ListBoxModel
+{
+public:
+    MessageLogView();
+    /**
+     * Appends a batch of text, and updates the view once.
+     */
+    void append(const juce::String &text);
+    void clear();
+    void setLineCap(int cap);
+    void resized() override;
+    /**
+     * Copies the selected rows to the clipboard.
+     */
+    bool keyPressed(const juce::KeyPress &key) override;
+
+private:
+    int getNumRows() override;
+    void paintListBoxItem(int row, juce::Graphics &g, int width, int height, bool selected) override;
+    bool isScrolledToEnd();
+    void updateContent(bool scroll_to_end);
+    void updateCount();
+    MessageLog log;
+    juce::Font font;
+    float char_width = 0.f;
+    juce::TextEditor searchEditor;
+    juce::Label countLabel;
+    juce::ListBox listBox;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (MessageLogView)
+};
@@ -0,0 +1,128 @@
+#include "OpcodeCatalogue.h"
+#include "OpcodeManifest.h"
+#include "csd_ids.h"
+
+#include <algorithm>
+#include <mutex>
+
+std::atomic<const OpcodeCatalogue *> OpcodeCatalogue::instance {nullptr};
+
+/**
+ * Orchestra keywords that are not opcodes.
+ */
+static const char *orchestra_keywords[] =
+{
+    "instr", "endin", "opcode", "endop",
+    "sr", "kr", "ksmps", "nchnls", "nchnls_i", "A4",
+    "if", "then", "ithen", "kthen", "elseif", "else", "endif",
+    "while", "until", "do", "od",
+};
+
+/**
+ * Lists the opcodes. Listing cannot be interrupted, so the builder is
+ * owned by the process rather than by a Loader, and only its destructor,
+ * when the process exits or the plugin is unloaded, waits for it without
+ * a limit.
+ */
+class OpcodeCatalogueBuilder : public juce::Thread
+{
+public:
+    OpcodeCatalogueBuilder()
+        : juce::Thread("OpcodeCatalogue")
+    {
+    }
+    ~OpcodeCatalogueBuilder() override
+    {
+        stopThread(-1);
+    }
+
+private:
+    void run() override;
+};
+
+/**
+ * The builder is destroyed first, so that the catalogue outlives its
+ * thread.
+ */
+static std::unique_ptr<const OpcodeCatalogue> catalogue;
+static std::mutex builder_mutex;
+static std::unique_ptr<OpcodeCatalogueBuilder> builder;
+
+OpcodeCatalogue::Loader::Loader()
+{
+    std::lock_guard<std::mutex> lock(builder_mutex);
+    if (builder == nullptr)
+    {
+        builder = std::make_unique<OpcodeCatalogueBuilder>();
+        builder->startThread(juce::Thread::Priority::background);
+    }
+}
+
+/**
+ * The builder, once created, is never released before the process exits.
+ */
+OpcodeCatalogue::Loader::~Loader()
+{
+    OpcodeCatalogueBuilder *running_builder;
+    {
+        std::lock_guard<std::mutex> lock(builder_mutex);
+        running_builder = builder.get();
+    }
+    if (running_builder != nullptr && !running_builder->waitForThreadToExit(wait_milliseconds))
+    {
+        DBG("OpcodeCatalogue: still listing opcodes; it will finish in the background.");
+    }
+}
+
+void OpcodeCatalogueBuilder::run()
+{
+    auto opcodes = OpcodeManifest::listOpcodes(nullptr);
+    std::vector<std::string> names(opcodes.begin(), opcodes.end());
+    if (names.empty())
+    {
+        // Without Csound's own list, falls back to the built-in one.
+        for (size_t id = 0; csd_ids[id] != nullptr; ++id)
+        {
+            names.emplace_back(csd_ids[id]);
+        }
+    }
+    names.insert(names.end(), std::begin(orchestra_keywords), std::end(orchestra_keywords));
+    catalogue.reset(new OpcodeCatalogue(std::move(names)));
+    DBG("OpcodeCatalogue: " << int(catalogue->getCount()) << " names.");
+    OpcodeCatalogue::instance.store(catalogue.get(), std::memory_order_release);
+}
+
+const OpcodeCatalogue *OpcodeCatalogue::get()
+{
+    return instance.load(std::memory_order_acquire);
+}
+
+OpcodeCatalogue::OpcodeCatalogue(std::vector<std::string> names_)
+    : names(std::move(names_))
+{
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    lookup.reserve(names.size());
+    for (const auto &name : names)
+    {
+        lookup.insert(name);
+    }
+}
+
+/**
+ * The names with the prefix are adjacent in the sorted names, starting at
+ * the first name not less than the prefix.
+ */
+std::vector<std::string_view> OpcodeCatalogue::complete(std::string_view prefix, size_t limit) const
+{
+    std::vector<std::string_view> result;
+    auto it = std::lower_bound(names.begin(), names.end(), prefix, [](const std::string &name, std::string_view prefix_)
+    {
+        return std::string_view(name) < prefix_;
+    });
+    for (; it != names.end() && result.size() < limit && std::string_view(*it).substr(0, prefix.size()) == prefix; ++it)
+    {
+        result.emplace_back(*it);
+    }
+    return result;
+}
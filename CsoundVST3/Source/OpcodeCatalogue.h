@@ -0,0 +1,65 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+/**
+ * The names of the opcodes that the linked Csound registers, including
+ * those of the plugin libraries in its default opcode directory, and of
+ * the orchestra's other keywords, for highlighting and completion.
+ *
+ * The catalogue is built at most once per process, on a background thread,
+ * when the first editor is opened, and is then shared, immutable, by every
+ * editor. Until it is
+ * built, get() returns null, and the tokeniser uses csd_ids instead.
+ */
+class OpcodeCatalogue
+{
+public:
+    /**
+     * Builds the catalogue on a background thread, if it has not been
+     * built. Hold one as a juce::SharedResourcePointer: the first one
+     * starts the thread, and the last one waits for it to finish, for up
+     * to wait_milliseconds. A thread that is still listing opcodes then is
+     * left to finish, and is waited for when the process exits.
+     */
+    class Loader
+    {
+    public:
+        static constexpr int wait_milliseconds = 1000;
+        Loader();
+        ~Loader();
+    };
+    /**
+     * Returns the catalogue, or null if it has not been built yet.
+     */
+    static const OpcodeCatalogue *get();
+    bool contains(std::string_view name) const
+    {
+        return lookup.count(name) != 0;
+    }
+    /**
+     * Returns up to limit names that start with prefix, in order.
+     */
+    std::vector<std::string_view> complete(std::string_view prefix, size_t limit) const;
+    size_t getCount() const
+    {
+        return names.size();
+    }
+
+private:
+    friend class OpcodeCatalogueBuilder;
+    OpcodeCatalogue(std::vector<std::string> names);
+    static std::atomic<const OpcodeCatalogue *> instance;
+    /**
+     * Sorted, for completion; the lookup set views these strings.
+     */
+    std::vector<std::string> names;
+    std::unordered_set<std::string_view> lookup;
+};
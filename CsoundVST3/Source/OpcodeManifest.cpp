@@ -0,0 +1,378 @@
+#include "OpcodeManifest.h"
+#include "CsoundTokeniser.h"
+#include <csound.h>
+#include <fstream>
+#include <mutex>
+
+#if JUCE_LINUX
+#include <unistd.h>
+#elif JUCE_MAC
+#include <mach/mach.h>
+#elif JUCE_WINDOWS
+#include <windows.h>
+#include <psapi.h>
+#endif
+
+static const char *manifest_begin_tag = "<CsoundVST3Opcodes>";
+static const char *manifest_end_tag = "</CsoundVST3Opcodes>";
+
+/**
+ * Returns the text between the begin and end tags, or an empty string.
+ */
+static juce::String getElementText(const juce::String &csd, const juce::String &begin_tag, const juce::String &end_tag)
+{
+    auto begin = csd.indexOf(begin_tag);
+    if (begin == -1)
+    {
+        return {};
+    }
+    begin += begin_tag.length();
+    auto end = csd.indexOf(begin, end_tag);
+    if (end == -1)
+    {
+        return {};
+    }
+    return csd.substring(begin, end);
+}
+
+/**
+ * Library names in the manifest may omit the "lib" prefix and the platform's
+ * file name extension.
+ */
+static juce::String getLibraryBaseName(const juce::String &name)
+{
+    auto base_name = juce::File::createFileWithoutCheckingPath(name).getFileNameWithoutExtension();
+    if (base_name.startsWith("lib"))
+    {
+        base_name = base_name.substring(3);
+    }
+    return base_name;
+}
+
+bool OpcodeManifest::parse(const juce::String &csd)
+{
+    declared = csd.contains(manifest_begin_tag);
+    automatic = false;
+    declared_libraries.clear();
+    if (declared == false)
+    {
+        return false;
+    }
+    auto text = getElementText(csd, manifest_begin_tag, manifest_end_tag);
+    juce::StringArray words;
+    words.addTokens(text, " \t\r\n,;", "\"");
+    words.trim();
+    words.removeEmptyStrings();
+    for (auto &word : words)
+    {
+        if (word.equalsIgnoreCase("auto"))
+        {
+            automatic = true;
+        }
+        else
+        {
+            declared_libraries.addIfNotAlreadyThere(getLibraryBaseName(word));
+        }
+    }
+    return true;
+}
+
+bool OpcodeManifest::isAutomatic() const
+{
+    return automatic;
+}
+
+const juce::StringArray &OpcodeManifest::getDeclaredLibraries() const
+{
+    return declared_libraries;
+}
+
+juce::File OpcodeManifest::getOpcodeDirectory()
+{
+    const char *environment_variables[] = {
+#if defined(CSOUND_VERSION_MAJOR) && (CSOUND_VERSION_MAJOR >= 7)
+        "OPCODE7DIR64",
+#endif
+        "OPCODE6DIR64",
+    };
+    for (auto environment_variable : environment_variables)
+    {
+        auto value = juce::SystemStats::getEnvironmentVariable(environment_variable, {});
+        if (value.isNotEmpty() && juce::File::isAbsolutePath(value) && juce::File(value).isDirectory())
+        {
+            return juce::File(value);
+        }
+    }
+#if defined(CSOUND_VERSION_MAJOR) && (CSOUND_VERSION_MAJOR >= 7)
+    const char *default_directories[] = {
+        "/Library/Frameworks/CsoundLib64.framework/Versions/7.0/Resources/Opcodes64",
+        "/usr/local/lib/csound/plugins64-7.0",
+        "/usr/lib/csound/plugins64-7.0",
+        "/usr/lib/x86_64-linux-gnu/csound/plugins64-7.0",
+        "/usr/lib/aarch64-linux-gnu/csound/plugins64-7.0",
+        "/opt/homebrew/lib/csound/plugins64-7.0",
+        "C:/Program Files/Csound7_x64/plugins64",
+    };
+#else
+    const char *default_directories[] = {
+        "/Library/Frameworks/CsoundLib64.framework/Versions/6.0/Resources/Opcodes64",
+        "/usr/local/lib/csound/plugins64-6.0",
+        "/usr/lib/csound/plugins64-6.0",
+        "/usr/lib/x86_64-linux-gnu/csound/plugins64-6.0",
+        "/usr/lib/aarch64-linux-gnu/csound/plugins64-6.0",
+        "/opt/homebrew/lib/csound/plugins64-6.0",
+        "C:/Program Files/Csound6_x64/plugins64",
+    };
+#endif
+    for (auto default_directory : default_directories)
+    {
+        juce::File directory(default_directory);
+        if (directory.isDirectory())
+        {
+            return directory;
+        }
+    }
+    return {};
+}
+
+juce::Array<juce::File> OpcodeManifest::getOpcodeLibraries(const juce::File &opcode_directory)
+{
+#if JUCE_MAC
+    auto pattern = "*.dylib";
+#elif JUCE_WINDOWS
+    auto pattern = "*.dll";
+#else
+    auto pattern = "*.so";
+#endif
+    auto libraries = opcode_directory.findChildFiles(juce::File::findFiles, false, pattern);
+    libraries.sort();
+    return libraries;
+}
+
+std::set<std::string> OpcodeManifest::listOpcodes(const char *opcodedir)
+{
+    std::set<std::string> names;
+    CSOUND *csound = createCsound(opcodedir);
+    if (csound == nullptr)
+    {
+        return names;
+    }
+    opcodeListEntry *entries = nullptr;
+#if defined(CSOUND_VERSION_MAJOR) && (CSOUND_VERSION_MAJOR >= 7)
+    auto count = csoundGetOpcodes(csound, &entries);
+#else
+    auto count = csoundNewOpcodeList(csound, &entries);
+#endif
+    for (int i = 0; entries != nullptr && i < count; ++i)
+    {
+        if (entries[i].opname != nullptr)
+        {
+            names.insert(entries[i].opname);
+        }
+    }
+    if (entries != nullptr)
+    {
+        csoundDisposeOpcodeList(csound, entries);
+    }
+    csoundDestroy(csound);
+    return names;
+}
+
+CSOUND *OpcodeManifest::createCsound(const char *opcodedir)
+{
+#if defined(CSOUND_VERSION_MAJOR) && (CSOUND_VERSION_MAJOR >= 7)
+    return csoundCreate(nullptr, opcodedir);
+#else
+    // Csound 6's opcode directory is global, and is read when an instance
+    // is created; it is set only for as long as that takes.
+    static std::mutex opcodedir_mutex;
+    std::lock_guard<std::mutex> lock(opcodedir_mutex);
+    csoundSetOpcodedir(opcodedir);
+    auto csound = csoundCreate(nullptr);
+    csoundSetOpcodedir(nullptr);
+    return csound;
+#endif
+}
+
+int64_t OpcodeManifest::getResidentSetSizeBytes()
+{
+#if JUCE_LINUX
+    std::ifstream statm("/proc/self/statm");
+    int64_t total_pages = 0;
+    int64_t resident_pages = 0;
+    if (statm >> total_pages >> resident_pages)
+    {
+        return resident_pages * int64_t(sysconf(_SC_PAGESIZE));
+    }
+    return 0;
+#elif JUCE_MAC
+    mach_task_basic_info info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t)&info, &count) == KERN_SUCCESS)
+    {
+        return int64_t(info.resident_size);
+    }
+    return 0;
+#elif JUCE_WINDOWS
+    PROCESS_MEMORY_COUNTERS counters;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+        return int64_t(counters.WorkingSetSize);
+    }
+    return 0;
+#else
+    return 0;
+#endif
+}
+
+juce::File OpcodeManifest::getCacheDirectory()
+{
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory).getChildFile("CsoundVST3").getChildFile("opcodes");
+}
+
+/**
+ * Creates a directory containing links to (or, where links are not
+ * supported, copies of) the libraries.
+ */
+static bool createLibraryDirectory(const juce::File &directory, const juce::Array<juce::File> &libraries)
+{
+    if (directory.createDirectory().failed())
+    {
+        return false;
+    }
+    for (const auto &library : libraries)
+    {
+        auto link = directory.getChildFile(library.getFileName());
+        if (link.exists())
+        {
+            continue;
+        }
+        if (library.createSymbolicLink(link, true) == false && library.copyFileTo(link) == false)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+const std::map<std::string, std::string> &OpcodeManifest::getOpcodeIndex(const juce::File &opcode_directory, std::function<void(const juce::String &)> log)
+{
+    // The index is built at most once per process, by whichever instance
+    // first needs it.
+    static std::mutex mutex;
+    static std::map<std::string, std::string> index;
+    static juce::String indexed_directory;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto libraries = getOpcodeLibraries(opcode_directory);
+    auto signature = juce::String::formatted("%s %lld %d", opcode_directory.getFullPathName().toRawUTF8(), (long long)opcode_directory.getLastModificationTime().toMilliseconds(), libraries.size());
+    if (indexed_directory == signature)
+    {
+        return index;
+    }
+    index.clear();
+    indexed_directory = signature;
+    auto cache_file = getCacheDirectory().getChildFile("opcode_index.txt");
+    juce::StringArray lines;
+    cache_file.readLines(lines);
+    if (lines.size() > 0 && lines[0] == signature)
+    {
+        for (int i = 1; i < lines.size(); ++i)
+        {
+            auto opcode = lines[i].upToFirstOccurrenceOf("\t", false, false);
+            auto library = lines[i].fromFirstOccurrenceOf("\t", false, false);
+            if (opcode.isNotEmpty() && library.isNotEmpty())
+            {
+                index[opcode.toStdString()] = library.toStdString();
+            }
+        }
+        log(juce::String::formatted("Opcode index: read %d opcodes from %s.\n", int(index.size()), cache_file.getFullPathName().toRawUTF8()));
+        return index;
+    }
+    // Probe each library in isolation, and subtract the opcodes that Csound
+    // registers with no plugin libraries at all.
+    log(juce::String::formatted("Opcode index: probing %d libraries in %s...\n", libraries.size(), opcode_directory.getFullPathName().toRawUTF8()));
+    auto start_time = juce::Time::getMillisecondCounterHiRes();
+    auto probe_directory = getCacheDirectory().getChildFile("probe");
+    probe_directory.deleteRecursively();
+    auto empty_directory = probe_directory.getChildFile("none");
+    empty_directory.createDirectory();
+    auto builtin_opcodes = listOpcodes(empty_directory.getFullPathName().toRawUTF8());
+    for (const auto &library : libraries)
+    {
+        auto library_directory = probe_directory.getChildFile(library.getFileNameWithoutExtension());
+        if (createLibraryDirectory(library_directory, { library }) == false)
+        {
+            continue;
+        }
+        auto opcodes = listOpcodes(library_directory.getFullPathName().toRawUTF8());
+        for (const auto &opcode : opcodes)
+        {
+            if (builtin_opcodes.count(opcode) == 0)
+            {
+                index.emplace(opcode, library.getFileName().toStdString());
+            }
+        }
+    }
+    probe_directory.deleteRecursively();
+    juce::String text = signature + "\n";
+    for (const auto &[opcode, library] : index)
+    {
+        text << juce::String(opcode) << "\t" << juce::String(library) << "\n";
+    }
+    cache_file.getParentDirectory().createDirectory();
+    cache_file.replaceWithText(text);
+    log(juce::String::formatted("Opcode index: indexed %d opcodes in %.1f ms.\n", int(index.size()), juce::Time::getMillisecondCounterHiRes() - start_time));
+    return index;
+}
+
+juce::String OpcodeManifest::getRestrictedOpcodeDirectory(const juce::String &csd, std::function<void(const juce::String &)> log) const
+{
+    if (declared == false)
+    {
+        return {};
+    }
+    auto opcode_directory = getOpcodeDirectory();
+    if (opcode_directory.isDirectory() == false)
+    {
+        log("Opcode manifest: Csound's opcode directory was not found, loading all opcode libraries.\n");
+        return {};
+    }
+    auto libraries = getOpcodeLibraries(opcode_directory);
+    juce::StringArray required_libraries(declared_libraries);
+    if (automatic)
+    {
+        const auto &index = getOpcodeIndex(opcode_directory, log);
+        auto orchestra = getElementText(csd, "<CsInstruments>", "</CsInstruments>");
+        CsoundTokeniser tokeniser;
+        for (const auto &identifier : tokeniser.getIdentifiers(orchestra))
+        {
+            auto it = index.find(identifier);
+            if (it != index.end())
+            {
+                required_libraries.addIfNotAlreadyThere(getLibraryBaseName(it->second));
+            }
+        }
+    }
+    juce::Array<juce::File> allowed_libraries;
+    for (const auto &library : libraries)
+    {
+        if (required_libraries.contains(getLibraryBaseName(library.getFileName())))
+        {
+            allowed_libraries.add(library);
+        }
+    }
+    juce::StringArray allowed_names;
+    for (const auto &library : allowed_libraries)
+    {
+        allowed_names.add(library.getFileName());
+    }
+    log(juce::String::formatted("Opcode manifest: loading %d of %d opcode libraries: %s\n", allowed_libraries.size(), libraries.size(), allowed_names.joinIntoString(" ").toRawUTF8()));
+    auto key = opcode_directory.getFullPathName() + "|" + allowed_names.joinIntoString("|");
+    auto restricted_directory = getCacheDirectory().getChildFile("restricted").getChildFile(juce::String::toHexString(key.hashCode64()));
+    if (createLibraryDirectory(restricted_directory, allowed_libraries) == false)
+    {
+        log("Opcode manifest: failed to create the restricted opcode directory, loading all opcode libraries.\n");
+        return {};
+    }
+    return restricted_directory.getFullPathName();
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <csound.h>
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+/**
+ * Restricts the plugin opcode libraries that Csound loads for a csd.
+ *
+ * Csound normally loads every library in its plugin directory for every
+ * instance, which costs startup time and memory. A csd can declare which
+ * libraries it needs in a <CsoundVST3Opcodes> element placed outside the
+ * <CsoundSynthesizer> element (where Csound ignores it, as it ignores
+ * <Cabbage>), for example:
+ *
+ *     <CsoundVST3Opcodes>
+ *     libfluidOpcodes libsignalflowgraph
+ *     </CsoundVST3Opcodes>
+ *
+ * The word "auto" in the element derives the libraries from the opcodes
+ * that the <CsInstruments> element actually uses, as found by the
+ * CsoundTokeniser, using an index of which library registers which opcode.
+ * The index is built once by probing each library, and is cached on disk.
+ *
+ * The restriction is implemented as a cached directory of links to the
+ * allowed libraries, which is passed to Csound as its opcode directory.
+ */
+class OpcodeManifest
+{
+public:
+    /**
+     * Parses the <CsoundVST3Opcodes> element of the csd. Returns false if
+     * the csd declares no manifest, in which case Csound should load all of
+     * its opcode libraries as usual.
+     */
+    bool parse(const juce::String &csd);
+    bool isAutomatic() const;
+    const juce::StringArray &getDeclaredLibraries() const;
+    /**
+     * Returns a directory that contains only the opcode libraries required
+     * by the parsed manifest for this csd, creating it if necessary; or an
+     * empty string if no restriction can be applied, in which case Csound
+     * should use its default plugin directory.
+     */
+    juce::String getRestrictedOpcodeDirectory(const juce::String &csd, std::function<void(const juce::String &)> log) const;
+    /**
+     * Returns Csound's plugin opcode directory, from the environment or
+     * else from the default installation locations.
+     */
+    static juce::File getOpcodeDirectory();
+    /**
+     * Returns the opcode library files in the opcode directory.
+     */
+    static juce::Array<juce::File> getOpcodeLibraries(const juce::File &opcode_directory);
+    /**
+     * Returns the names of all opcodes that a new Csound instance, loading
+     * plugin libraries only from opcodedir (or from the default directory,
+     * if opcodedir is null), has registered.
+     */
+    static std::set<std::string> listOpcodes(const char *opcodedir);
+    /**
+     * Creates a Csound instance that loads plugin opcode libraries only from
+     * opcodedir, or from the default directory if opcodedir is null.
+     */
+    static CSOUND *createCsound(const char *opcodedir);
+    /**
+     * Returns the resident set size of this process in bytes, or 0 if it is
+     * not available on this platform. Used to report the savings from
+     * loading fewer opcode libraries.
+     */
+    static int64_t getResidentSetSizeBytes();
+
+private:
+    /**
+     * Returns the index of opcode name to library file name, reading it
+     * from the cache or else building it.
+     */
+    static const std::map<std::string, std::string> &getOpcodeIndex(const juce::File &opcode_directory, std::function<void(const juce::String &)> log);
+    static juce::File getCacheDirectory();
+    bool declared = false;
+    bool automatic = false;
+    juce::StringArray declared_libraries;
+};
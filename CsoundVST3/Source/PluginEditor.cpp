@@ -19,7 +19,9 @@ CsoundVST3AudioProcessorEditor::CsoundVST3AudioProcessorEditor (CsoundVST3AudioP
     addAndMakeVisible(playButton);
     addAndMakeVisible(stopButton);
     addAndMakeVisible(findButton);
+    addAndMakeVisible(settingsButton);
     addAndMakeVisible(aboutButton);
+    addAndMakeVisible(jumpBox);
 
     // Attach listeners
     openButton.addListener(this);
@@ -28,34 +30,70 @@ CsoundVST3AudioProcessorEditor::CsoundVST3AudioProcessorEditor (CsoundVST3AudioP
     playButton.addListener(this);
     stopButton.addListener(this);
     findButton.addListener(this);
+    settingsButton.addListener(this);
     aboutButton.addListener(this);
+    jumpBox.setTextWhenNothingSelected("Go to...");
+    jumpBox.onChange = [this]
+    {
+        auto item = jumpBox.getSelectedItemIndex();
+        if (item >= 0 && item < int(jump_lines.size()))
+        {
+            auto line = jump_lines[size_t(item)];
+            codeEditor->scrollToLine(std::max(0, line - 2));
+            codeEditor->moveCaretTo(juce::CodeDocument::Position(csd_document, line, 0), false);
+            codeEditor->grabKeyboardFocus();
+        }
+        jumpBox.setSelectedItemIndex(-1, juce::dontSendNotification);
+    };
 
     // Status Bar
     statusBar.setText("Ready", juce::dontSendNotification);
     statusBar.setJustificationType(juce::Justification::left);
     addAndMakeVisible(statusBar);
+    loadMeterLabel.setJustificationType(juce::Justification::right);
+    loadMeterLabel.setTooltip("DSP load: the time processBlock takes, and when rendering on shared threads, the time the block then takes to render, "
+        "as a percentage of the time its audio lasts, now, at peak, and at the 99th percentile; "
+        "the 99th percentile for Csound's kperiods; and the number of blocks, and of kperiods, that overran. Reset on Play.");
+    addAndMakeVisible(loadMeterLabel);
 
     // Code Editor
     csd_code_tokeniser = std::make_unique<CsoundTokeniser>();
     codeEditor = std::make_unique<juce::CodeEditorComponent>(csd_document, csd_code_tokeniser.get());
+    csd_code_tokeniser->attach(csd_document, [this]
+    {
+        auto first_line = codeEditor->getFirstLineOnScreen();
+        return juce::Range<int>(first_line, first_line + codeEditor->getNumLinesOnScreen() + 1);
+    });
     addAndMakeVisible(*codeEditor);
+    codeEditor->addKeyListener(this);
     codeEditor->setReadOnly(false);
     codeEditor->setColour(juce::CodeEditorComponent::backgroundColourId, juce::Colours::darkslategrey);
     codeEditor->setColour(juce::CodeEditorComponent::defaultTextColourId, juce::Colours::seashell);
+    csd_loader.onProgress = [this]
+    {
+        statusBar.setText(juce::String::formatted("Loading csd... %d%%", int(100. * csd_loader.getProgress())), juce::dontSendNotification);
+    };
+    csd_loader.onLoaded = [this]
+    {
+        codeEditor->setReadOnly(false);
+        codeEditor->moveCaretTo(juce::CodeDocument::Position(csd_document, 0), false);
+        commitCsd();
+        statusBar.setText("Csd loaded.", juce::dontSendNotification);
+    };
 
     // Message Log
-    messageLog = std::make_unique<juce::CodeEditorComponent>(messages_document, nullptr);
+    messageLog = std::make_unique<MessageLogView>();
+    messageLog->setLineCap(audioProcessor.message_log_lines);
     addAndMakeVisible(*messageLog);
-    messageLog->setReadOnly(true);
-    messageLog->setColour(juce::CodeEditorComponent::backgroundColourId, juce::Colours::black);
-    messageLog->setColour(juce::CodeEditorComponent::defaultTextColourId, juce::Colours::lightgreen);
 
     // Vertical Layout
     verticalLayout.setItemLayout(0, -0.1, -0.9, -0.5); // Top window
     verticalLayout.setItemLayout(1, 8, 8, 8);          // Divider
     verticalLayout.setItemLayout(2, -0.1, -0.9, -0.5); // Bottom window
     addAndMakeVisible(divider);
-    codeEditor->loadContent(audioProcessor.csd);
+    loadCsdIfChanged();
+    csd_index = std::make_unique<CsdIndex>(csd_document);
+    csd_index->addChangeListener(this);
     
     // Listen for changes from the processor
     audioProcessor.addChangeListener(this);
@@ -68,6 +106,8 @@ CsoundVST3AudioProcessorEditor::CsoundVST3AudioProcessorEditor (CsoundVST3AudioP
 CsoundVST3AudioProcessorEditor::~CsoundVST3AudioProcessorEditor()
 {
     audioProcessor.removeChangeListener(this);
+    csd_index->removeChangeListener(this);
+    codeEditor->removeKeyListener(this);
     stopTimer();
 }
 
@@ -96,17 +136,22 @@ void CsoundVST3AudioProcessorEditor::resized()
     stopButton.setTooltip("Stop the Csound performance");
     findButton.setBounds(menuBar.removeFromLeft(80));
     findButton.setTooltip("Search and replace...");
+    settingsButton.setBounds(menuBar.removeFromLeft(100));
+    settingsButton.setTooltip("Edit the plugin settings");
     aboutButton.setBounds(menuBar.removeFromLeft(100));
     aboutButton.setTooltip("About CsoundVST3");
+    jumpBox.setBounds(menuBar.reduced(2));
+    jumpBox.setTooltip("Go to an element, instrument, or opcode of the .csd");
 
     // Status Bar
     auto statusBarHeight = 20;
-    statusBar.setBounds(bounds.removeFromBottom(statusBarHeight));
+    auto statusBarArea = bounds.removeFromBottom(statusBarHeight);
+    loadMeterLabel.setBounds(statusBarArea.removeFromRight(440));
+    statusBar.setBounds(statusBarArea);
 
     juce::Component *components[] = {codeEditor.get(), &divider, messageLog.get()};
     verticalLayout.layOutComponents(components, 3, bounds.getX(), bounds.getY(), bounds.getWidth(), bounds.getHeight(), true, true) ;
     setWantsKeyboardFocus(true);
-    messageLog->setReadOnly(false);
  }
 
 void CsoundVST3AudioProcessorEditor::buttonClicked(juce::Button* button)
@@ -122,11 +167,11 @@ void CsoundVST3AudioProcessorEditor::buttonClicked(juce::Button* button)
         {
             csd_file = chooser.getResult();
             DBG("Selected file to open: " << csd_file.getFullPathName());
-            if (csd_file.existsAsFile())
+            if (csd_file.existsAsFile() && csd_loader.load(csd_file))
             {
-                audioProcessor.csd = csd_file.loadFileAsString();
-                codeEditor->loadContent(audioProcessor.csd);
-                statusBar.setText("Csd loaded.", juce::dontSendNotification);
+                // The editor is read-only until the whole file is loaded.
+                codeEditor->setReadOnly(true);
+                statusBar.setText("Loading csd...", juce::dontSendNotification);
            }
             else
             {
@@ -135,9 +180,13 @@ void CsoundVST3AudioProcessorEditor::buttonClicked(juce::Button* button)
 
         });
     }
+    else if (csd_loader.isLoading() && (button == &saveButton || button == &saveAsButton))
+    {
+        statusBar.setText("The csd is still loading.", juce::dontSendNotification);
+    }
     else if (button == &saveButton)
     {
-        audioProcessor.csd = codeEditor->getDocument().getAllContent();
+        commitCsd();
         statusBar.setText("Saved", juce::dontSendNotification);
     }
     else if (button == &saveAsButton)
@@ -152,8 +201,8 @@ void CsoundVST3AudioProcessorEditor::buttonClicked(juce::Button* button)
                 juce::File selectedFile = chooser.getResult();
                 if (selectedFile.create().wasOk())
                 {
-                    audioProcessor.csd = codeEditor->getDocument().getAllContent();
-                    if (selectedFile.replaceWithText(audioProcessor.csd))
+                    auto csd = commitCsd();
+                    if (selectedFile.replaceWithText(csd))
                     {
                         DBG("File saved successfully: " << selectedFile.getFullPathName());
                     }
@@ -190,6 +239,10 @@ void CsoundVST3AudioProcessorEditor::buttonClicked(juce::Button* button)
         //dialog->centreWithSize(400, 150);
         juce::DialogWindow::showDialog("Search and Replace", new SearchAndReplaceDialog(*codeEditor), nullptr, juce::Colours::darkgrey, true, false);
     }
+    else if (button == &settingsButton)
+    {
+        juce::DialogWindow::showDialog("Settings", new SettingsDialog(audioProcessor), nullptr, juce::Colours::darkgrey, true, false);
+    }
     else if (button == &aboutButton)
     {
         showAboutDialog(this);
@@ -197,15 +250,223 @@ void CsoundVST3AudioProcessorEditor::buttonClicked(juce::Button* button)
 
 }
 
-void CsoundVST3AudioProcessorEditor::changeListenerCallback(juce::ChangeBroadcaster*)
+void CsoundVST3AudioProcessorEditor::changeListenerCallback(juce::ChangeBroadcaster *source)
+{
+    if (source == csd_index.get())
+    {
+        updateJumpBox();
+        return;
+    }
+    loadCsdIfChanged();
+}
+
+/**
+ * Lists the elements, instruments, and opcodes of the latest index of the
+ * csd, in order, in the jump box.
+ */
+void CsoundVST3AudioProcessorEditor::updateJumpBox()
+{
+    auto snapshot = csd_index->getSnapshot();
+    std::vector<const CsdIndex::Block *> blocks;
+    for (const auto &block : snapshot->getElements())
+    {
+        blocks.push_back(&block);
+    }
+    for (const auto &block : snapshot->getDefinitions())
+    {
+        blocks.push_back(&block);
+    }
+    std::stable_sort(blocks.begin(), blocks.end(), [](const CsdIndex::Block *a, const CsdIndex::Block *b)
+    {
+        return a->first_line < b->first_line;
+    });
+    jumpBox.clear(juce::dontSendNotification);
+    jump_lines.clear();
+    for (const auto *block : blocks)
+    {
+        switch (block->kind)
+        {
+        case CsdIndex::ELEMENT:
+            jumpBox.addItem("<" + block->name + ">", int(jump_lines.size()) + 1);
+            break;
+        case CsdIndex::INSTRUMENT:
+            jumpBox.addItem("    instr " + block->name, int(jump_lines.size()) + 1);
+            break;
+        case CsdIndex::OPCODE:
+            jumpBox.addItem("    opcode " + block->name, int(jump_lines.size()) + 1);
+            break;
+        }
+        jump_lines.push_back(block->first_line);
+    }
+}
+
+/**
+ * Ctrl+Space completes the word before the caret.
+ */
+bool CsoundVST3AudioProcessorEditor::keyPressed(const juce::KeyPress &key, juce::Component *)
+{
+    if (key.getKeyCode() == juce::KeyPress::spaceKey && key.getModifiers().isCtrlDown())
+    {
+        showCompletions();
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Lists the opcodes in the catalogue, and the csd's own opcodes, whose
+ * names start with the word before the caret, and completes the word with
+ * the one chosen, or with the only one.
+ */
+void CsoundVST3AudioProcessorEditor::showCompletions()
+{
+    auto caret = codeEditor->getCaretPos();
+    auto start = caret;
+    while (start.getIndexInLine() > 0)
+    {
+        auto c = start.movedBy(-1).getCharacter();
+        if (!juce::CharacterFunctions::isLetterOrDigit(c) && c != '_')
+        {
+            break;
+        }
+        start.moveBy(-1);
+    }
+    auto prefix = csd_document.getTextBetween(start, caret);
+    if (prefix.isEmpty())
+    {
+        return;
+    }
+    juce::StringArray completions;
+    if (opcode_catalogue != nullptr)
+    {
+        for (auto name : opcode_catalogue->complete(prefix.toStdString(), 100))
+        {
+            completions.add(juce::String(name.data(), name.size()));
+        }
+    }
+    for (const auto &block : csd_index->getSnapshot()->getDefinitions())
+    {
+        if (block.kind == CsdIndex::OPCODE && block.name.startsWith(prefix))
+        {
+            completions.addIfNotAlreadyThere(block.name);
+        }
+    }
+    if (completions.isEmpty())
+    {
+        return;
+    }
+    completions.sort(false);
+    // Completes only if the word has not changed since the menu was shown.
+    auto complete = [this, prefix, start_position = start.getPosition(), caret_position = caret.getPosition()](const juce::String &name)
+    {
+        auto word = csd_document.getTextBetween(juce::CodeDocument::Position(csd_document, start_position), juce::CodeDocument::Position(csd_document, caret_position));
+        if (codeEditor->getCaretPos().getPosition() == caret_position && word == prefix)
+        {
+            codeEditor->insertTextAtCaret(name.substring(prefix.length()));
+        }
+    };
+    if (completions.size() == 1)
+    {
+        complete(completions[0]);
+        return;
+    }
+    juce::PopupMenu menu;
+    for (int index = 0; index < completions.size(); ++index)
+    {
+        menu.addItem(index + 1, completions[index]);
+    }
+    juce::Component::SafePointer<CsoundVST3AudioProcessorEditor> editor(this);
+    auto area = codeEditor->localAreaToGlobal(codeEditor->getCharacterBounds(caret));
+    menu.showMenuAsync(juce::PopupMenu::Options().withTargetScreenArea(area), [editor, complete, completions](int result)
+    {
+        if (editor != nullptr && result > 0)
+        {
+            complete(completions[result - 1]);
+        }
+    });
+}
+
+/**
+ * Loads the processor's csd into the code editor if the plugin state has
+ * replaced it since the editor last loaded it.
+ */
+void CsoundVST3AudioProcessorEditor::loadCsdIfChanged()
+{
+    // The csd is copied, which only shares its text, and loaded after the
+    // lock is released, so that the host is not kept waiting to replace or
+    // compile it while a large csd loads.
+    juce::String csd;
+    {
+        juce::ScopedLock lock(audioProcessor.csd_lock);
+        if (loaded_csd_revision == audioProcessor.csd_revision)
+        {
+            return;
+        }
+        loaded_csd_revision = audioProcessor.csd_revision;
+        csd = audioProcessor.csd;
+    }
+    csd_loader.cancel();
+    codeEditor->setReadOnly(false);
+    codeEditor->loadContent(csd);
+}
+
+/**
+ * Copies the edited csd into the processor, which is the only time that the
+ * editor copies it, and returns it.
+ */
+juce::String CsoundVST3AudioProcessorEditor::commitCsd()
 {
+    auto text = csd_document.getAllContent();
+    juce::ScopedLock lock(audioProcessor.csd_lock);
+    audioProcessor.csd = text;
+    return text;
 }
 
+/**
+ * Shows the processor's load, and once the opcode catalogue has been built,
+ * highlights its opcodes. Formats the records in the processor's log ring,
+ * and appends them to the message log all at once, so that the log is
+ * updated at most once per tick.
+ */
 void CsoundVST3AudioProcessorEditor::timerCallback()
 {
-    while (auto message = audioProcessor.csound_messages_fifo.peek())
+    auto block = audioProcessor.load_meter.getStatistics(LoadMeter::BLOCK);
+    auto kperiod = audioProcessor.load_meter.getStatistics(LoadMeter::KPERIOD);
+    loadMeterLabel.setText(juce::String::formatted("DSP %3.0f%%  peak %3.0f%%  p99 %3.0f%%  kperiod p99 %3.0f%%  xruns %lld/%lld",
+        100. * block.current, 100. * block.peak, 100. * block.p99, 100. * kperiod.p99, (long long)block.xruns, (long long)kperiod.xruns), juce::dontSendNotification);
+    // Once the opcode catalogue has been built, highlights its opcodes.
+    if (opcode_catalogue == nullptr && (opcode_catalogue = OpcodeCatalogue::get()) != nullptr)
+    {
+        csd_code_tokeniser->setOpcodeCatalogue(opcode_catalogue);
+        codeEditor->retokenise(0, csd_document.getNumCharacters());
+    }
+    audioProcessor.flushLog();
+    messageLog->setLineCap(audioProcessor.message_log_lines);
+    juce::String text;
+    audioProcessor.log_ring.read([&text](const LogRing::Header &header, const char *message)
+    {
+        if (header.source != 0)
+        {
+            text << "Shard " << header.source << ": ";
+        }
+        text << juce::String::fromUTF8(message, int(header.length));
+        if ((header.flags & LogRing::truncated_flag) != 0)
+        {
+            text << "... (truncated)\n";
+        }
+    });
+    auto log_drops = audioProcessor.log_ring.getDroppedCount();
+    if (log_drops < reported_log_drops)
+    {
+        reported_log_drops = 0;
+    }
+    if (log_drops > reported_log_drops)
+    {
+        text << juce::String::formatted("(%lld messages dropped)\n", (long long)(log_drops - reported_log_drops));
+        reported_log_drops = log_drops;
+    }
+    if (text.isNotEmpty())
     {
-        messageLog->insertTextAtCaret(*message);
-        audioProcessor.csound_messages_fifo.pop();
+        messageLog->append(text);
     }
 }
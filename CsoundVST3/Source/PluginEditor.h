@@ -14,10 +14,15 @@
 #include <juce_gui_extra/juce_gui_extra.h>
 #include "PluginProcessor.h"
 #include "CsoundTokeniser.h"
+#include "CsdIndex.h"
+#include "CsdSearch.h"
+#include "CsdLoader.h"
+#include "OpcodeCatalogue.h"
 #include "csoundvst3_version.h"
 
 class SearchAndReplaceDialog : public juce::Component,
-                               private juce::Button::Listener
+                               private juce::Button::Listener,
+                               private juce::Timer
 {
 public:
     SearchAndReplaceDialog(juce::CodeEditorComponent& editor)
@@ -27,12 +32,24 @@ public:
         searchLabel.setText("Search:", juce::dontSendNotification);
 
         addAndMakeVisible(searchField);
+        searchField.onTextChange = [this] { startTimer(200); };
 
         addAndMakeVisible(replaceLabel);
         replaceLabel.setText("Replace:", juce::dontSendNotification);
 
         addAndMakeVisible(replaceField);
 
+        addAndMakeVisible(regexToggle);
+        regexToggle.setButtonText("Regular expression");
+        regexToggle.setTooltip("Search for an ECMAScript regular expression, within lines; replace with $1, $2, ... for its groups.");
+        regexToggle.onClick = [this] { startTimer(200); };
+
+        addAndMakeVisible(matchCaseToggle);
+        matchCaseToggle.setButtonText("Match case");
+        matchCaseToggle.onClick = [this] { startTimer(200); };
+
+        addAndMakeVisible(countLabel);
+
         addAndMakeVisible(searchButton);
         searchButton.setButtonText("Search");
         searchButton.addListener(this);
@@ -41,7 +58,11 @@ public:
         replaceButton.setButtonText("Replace");
         replaceButton.addListener(this);
 
-        setSize(400, 150);
+        addAndMakeVisible(replaceAllButton);
+        replaceAllButton.setButtonText("Replace all");
+        replaceAllButton.addListener(this);
+
+        setSize(400, 190);
     }
 
     void resized() override
@@ -57,65 +78,275 @@ public:
         replaceLabel.setBounds(row.removeFromLeft(70));
         replaceField.setBounds(row.reduced(margin));
 
+        row = bounds.removeFromTop(30);
+        regexToggle.setBounds(row.removeFromLeft(160));
+        matchCaseToggle.setBounds(row.removeFromLeft(110));
+        countLabel.setBounds(row);
+
         row = bounds.removeFromTop(40);
+        replaceAllButton.setBounds(row.removeFromRight(120).reduced(margin));
         replaceButton.setBounds(row.removeFromRight(120).reduced(margin));
         searchButton.setBounds(row.removeFromRight(120).reduced(margin));
      }
 
 private:
     juce::CodeEditorComponent& codeEditor;
+    CsdSearch search;
 
-    juce::Label searchLabel, replaceLabel;
+    juce::Label searchLabel, replaceLabel, countLabel;
     juce::TextEditor searchField, replaceField;
-    juce::TextButton searchButton, replaceButton;
+    juce::ToggleButton regexToggle, matchCaseToggle;
+    juce::TextButton searchButton, replaceButton, replaceAllButton;
+
+    /**
+     * Sets the search's pattern from the fields, and shows an error if the
+     * regular expression is not valid.
+     */
+    bool updateSearch()
+    {
+        juce::String error;
+        if (!search.setPattern(searchField.getText(), regexToggle.getToggleState(), matchCaseToggle.getToggleState(), error))
+        {
+            countLabel.setText(error, juce::dontSendNotification);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Counts matches once typing pauses, rather than on every keystroke.
+     */
+    void timerCallback() override
+    {
+        stopTimer();
+        if (updateSearch())
+        {
+            auto count = search.countMatches(codeEditor.getDocument());
+            countLabel.setText(search.isEmpty() ? juce::String() : juce::String(count) + (count == 1 ? " match" : " matches"), juce::dontSendNotification);
+        }
+    }
 
     void buttonClicked(juce::Button* button) override
     {
         auto& document = codeEditor.getDocument();
-        auto searchText = searchField.getText();
+        if (!updateSearch() || search.isEmpty())
+        {
+            return;
+        }
 
-        if (button == &searchButton)
+        if (button == &replaceAllButton)
         {
-            auto start = codeEditor.getHighlightedRegion().getEnd(); // Start after current selection
-            auto content = document.getAllContent();
-            auto foundPos = content.indexOf(start, searchText);
+            auto count = search.replaceAll(document, replaceField.getText());
+            countLabel.setText(juce::String(count) + " replaced", juce::dontSendNotification);
+            return;
+        }
 
-            if (foundPos != -1)
-            {
-                codeEditor.setHighlightedRegion({ foundPos, foundPos + searchText.length() });
-            }
-            else
+        auto start = codeEditor.getHighlightedRegion().getEnd(); // Start after current selection
+        if (button == &replaceButton)
+        {
+            auto region = codeEditor.getHighlightedRegion();
+            auto length = search.replace(document, region, replaceField.getText());
+            if (length >= 0)
             {
-                juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::InfoIcon,
-                                                  "Search", "Text not found.");
+                start = region.getStart() + length;
             }
         }
-        else if (button == &replaceButton)
+
+        if (auto match = search.findNext(document, start))
+        {
+            codeEditor.setHighlightedRegion({ match->position, match->position + match->length });
+        }
+        else
         {
-            auto replaceText = replaceField.getText();
-            auto start = codeEditor.getHighlightedRegion().getEnd();
-            auto content = document.getAllContent();
-            auto foundPos = content.indexOf(start, searchText);
+            juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::InfoIcon,
+                                              button == &searchButton ? "Search" : "Replace", "Text not found.");
+        }
+    }
+};
 
-            if (foundPos != -1)
+/**
+ * Edits the plugin's settings, which are saved with the plugin state.
+ * Settings that configure Csound take effect when Csound is next compiled.
+ */
+class SettingsDialog : public juce::Component
+{
+public:
+    SettingsDialog(CsoundVST3AudioProcessor& processor)
+        : audioProcessor(processor)
+    {
+        addAndMakeVisible(threadCountLabel);
+        threadCountLabel.setText("Csound threads:", juce::dontSendNotification);
+
+        addAndMakeVisible(threadCountSlider);
+        threadCountSlider.setRange(0, juce::SystemStats::getNumCpus(), 1);
+        threadCountSlider.setSliderStyle(juce::Slider::IncDecButtons);
+        threadCountSlider.setTextBoxStyle(juce::Slider::TextBoxLeft, false, 60, 24);
+        threadCountSlider.setTooltip(juce::String::formatted("Threads for Csound's parallel mode (-j), or 0 for automatic (%d). Takes effect on Play.",
+            CsoundVST3AudioProcessor::getDefaultCsoundThreadCount()));
+        threadCountSlider.setValue(audioProcessor.csound_thread_count.load(), juce::dontSendNotification);
+        threadCountSlider.onValueChange = [this]
+        {
+            audioProcessor.csound_thread_count = int(threadCountSlider.getValue());
+        };
+
+        addAndMakeVisible(sharedRenderPoolToggle);
+        sharedRenderPoolToggle.setButtonText("Render on shared threads (adds one block of latency)");
+        sharedRenderPoolToggle.setTooltip("Render on a pool of threads shared by all CsoundVST3 instances, so that instances run in parallel. Takes effect on Play.");
+        sharedRenderPoolToggle.setToggleState(audioProcessor.shared_render_pool.load(), juce::dontSendNotification);
+        sharedRenderPoolToggle.onClick = [this]
+        {
+            audioProcessor.shared_render_pool = sharedRenderPoolToggle.getToggleState();
+        };
+
+        addAndMakeVisible(hibernationLabel);
+        hibernationLabel.setText("Hibernate after:", juce::dontSendNotification);
+
+        addAndMakeVisible(hibernationSlider);
+        hibernationSlider.setRange(0, 60, 0.5);
+        hibernationSlider.setTextValueSuffix(" s");
+        hibernationSlider.setTextBoxStyle(juce::Slider::TextBoxLeft, false, 60, 24);
+        hibernationSlider.setTooltip("Stop rendering after this many seconds of silence with no notes held, or 0 to never stop. Takes effect on Play.");
+        hibernationSlider.setValue(audioProcessor.hibernation_tail_seconds.load(), juce::dontSendNotification);
+        hibernationSlider.onValueChange = [this]
+        {
+            audioProcessor.hibernation_tail_seconds = hibernationSlider.getValue();
+        };
+
+        addAndMakeVisible(voiceLimitLabel);
+        voiceLimitLabel.setText("Voice limit:", juce::dontSendNotification);
+
+        addAndMakeVisible(voiceLimitSlider);
+        voiceLimitSlider.setRange(0, 256, 1);
+        voiceLimitSlider.setSliderStyle(juce::Slider::IncDecButtons);
+        voiceLimitSlider.setTextBoxStyle(juce::Slider::TextBoxLeft, false, 60, 24);
+        voiceLimitSlider.setTooltip("The most MIDI notes performed at once, or 0 for no limit. Takes effect on Play.");
+        voiceLimitSlider.setValue(audioProcessor.voice_limit.load(), juce::dontSendNotification);
+        voiceLimitSlider.onValueChange = [this]
+        {
+            audioProcessor.voice_limit = int(voiceLimitSlider.getValue());
+        };
+
+        addAndMakeVisible(voiceStealPolicyBox);
+        voiceStealPolicyBox.addItem("Steal oldest", PolyphonyLimiter::STEAL_OLDEST + 1);
+        voiceStealPolicyBox.addItem("Steal quietest", PolyphonyLimiter::STEAL_QUIETEST + 1);
+        voiceStealPolicyBox.addItem("Steal highest channel", PolyphonyLimiter::STEAL_LOWEST_PRIORITY + 1);
+        voiceStealPolicyBox.setSelectedId(audioProcessor.voice_steal_policy.load() + 1, juce::dontSendNotification);
+        voiceStealPolicyBox.onChange = [this]
+        {
+            audioProcessor.voice_steal_policy = voiceStealPolicyBox.getSelectedId() - 1;
+        };
+
+        addAndMakeVisible(messageLogLinesLabel);
+        messageLogLinesLabel.setText("Message log lines:", juce::dontSendNotification);
+
+        addAndMakeVisible(messageLogLinesSlider);
+        messageLogLinesSlider.setRange(MessageLog::minimum_line_cap, MessageLog::maximum_line_cap, 100);
+        messageLogLinesSlider.setSkewFactorFromMidPoint(MessageLog::default_line_cap);
+        messageLogLinesSlider.setTextBoxStyle(juce::Slider::TextBoxLeft, false, 80, 24);
+        messageLogLinesSlider.setTooltip("The most lines that the message log keeps; older lines are discarded.");
+        messageLogLinesSlider.setValue(audioProcessor.message_log_lines.load(), juce::dontSendNotification);
+        messageLogLinesSlider.onValueChange = [this]
+        {
+            audioProcessor.message_log_lines = int(messageLogLinesSlider.getValue());
+        };
+
+        addAndMakeVisible(logTypesLabel);
+        logTypesLabel.setText("Log messages:", juce::dontSendNotification);
+        auto errors = CsoundVST3AudioProcessor::getLogTypeBit(CSOUNDMSG_ERROR);
+        auto warnings = CsoundVST3AudioProcessor::getLogTypeBit(CSOUNDMSG_WARNING);
+        auto orchestra = CsoundVST3AudioProcessor::getLogTypeBit(CSOUNDMSG_ORCH);
+        addLogTypeToggle(errorsToggle, "Errors", errors);
+        addLogTypeToggle(warningsToggle, "Warnings", warnings);
+        addLogTypeToggle(orchestraToggle, "Orchestra", orchestra);
+        addLogTypeToggle(otherToggle, "Other", CsoundVST3AudioProcessor::all_log_types & ~(errors | warnings | orchestra));
+        orchestraToggle.setTooltip("Log output from the orchestra's printing opcodes.");
+        otherToggle.setTooltip("Log Csound's informational and real-time messages.");
+
+        setSize(460, 260);
+    }
+
+    void resized() override
+    {
+        auto bounds = getLocalBounds().reduced(10);
+        int margin = 8;
+
+        auto row = bounds.removeFromTop(40);
+        threadCountLabel.setBounds(row.removeFromLeft(120));
+        threadCountSlider.setBounds(row.reduced(margin));
+
+        row = bounds.removeFromTop(40);
+        sharedRenderPoolToggle.setBounds(row.reduced(margin));
+
+        row = bounds.removeFromTop(40);
+        hibernationLabel.setBounds(row.removeFromLeft(120));
+        hibernationSlider.setBounds(row.reduced(margin));
+
+        row = bounds.removeFromTop(40);
+        voiceLimitLabel.setBounds(row.removeFromLeft(120));
+        voiceStealPolicyBox.setBounds(row.removeFromRight(150).reduced(margin));
+        voiceLimitSlider.setBounds(row.reduced(margin));
+
+        row = bounds.removeFromTop(40);
+        messageLogLinesLabel.setBounds(row.removeFromLeft(120));
+        messageLogLinesSlider.setBounds(row.reduced(margin));
+
+        row = bounds.removeFromTop(40);
+        logTypesLabel.setBounds(row.removeFromLeft(120));
+        auto toggleWidth = row.getWidth() / 4;
+        errorsToggle.setBounds(row.removeFromLeft(toggleWidth).reduced(margin));
+        warningsToggle.setBounds(row.removeFromLeft(toggleWidth).reduced(margin));
+        orchestraToggle.setBounds(row.removeFromLeft(toggleWidth).reduced(margin));
+        otherToggle.setBounds(row.reduced(margin));
+    }
+
+private:
+    /**
+     * Adds a toggle that logs, or discards before formatting, the Csound
+     * message types in bits. Takes effect at once.
+     */
+    void addLogTypeToggle(juce::ToggleButton &toggle, const juce::String &text, uint32_t bits)
+    {
+        addAndMakeVisible(toggle);
+        toggle.setButtonText(text);
+        toggle.setTooltip("Log Csound's " + text.toLowerCase() + ".");
+        toggle.setToggleState((audioProcessor.log_type_mask.load() & bits) != 0, juce::dontSendNotification);
+        toggle.onClick = [this, &toggle, bits]
+        {
+            if (toggle.getToggleState())
             {
-                document.deleteSection(foundPos, foundPos + searchText.length());
-                document.insertText(foundPos, replaceText);
-                codeEditor.setHighlightedRegion({ foundPos, foundPos + replaceText.length() });
+                audioProcessor.log_type_mask |= bits;
             }
             else
             {
-                juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::InfoIcon,
-                                                  "Replace", "Text not found.");
+                audioProcessor.log_type_mask &= ~bits;
             }
-        }
+        };
     }
+
+    CsoundVST3AudioProcessor& audioProcessor;
+
+    juce::Label threadCountLabel;
+    juce::Slider threadCountSlider;
+    juce::ToggleButton sharedRenderPoolToggle;
+    juce::Label hibernationLabel;
+    juce::Slider hibernationSlider;
+    juce::Label voiceLimitLabel;
+    juce::Slider voiceLimitSlider;
+    juce::ComboBox voiceStealPolicyBox;
+    juce::Label messageLogLinesLabel;
+    juce::Slider messageLogLinesSlider;
+    juce::Label logTypesLabel;
+    juce::ToggleButton errorsToggle;
+    juce::ToggleButton warningsToggle;
+    juce::ToggleButton orchestraToggle;
+    juce::ToggleButton otherToggle;
 };
 
 class CsoundVST3AudioProcessorEditor  : public juce::AudioProcessorEditor,
 public juce::Button::Listener,
 public juce::ChangeListener,
-public juce::Timer
+public juce::Timer,
+public juce::KeyListener
 // public juce::TooltipWindow
 {
     public:
@@ -127,10 +358,15 @@ public juce::Timer
     void resized() override;
     void changeListenerCallback(juce::ChangeBroadcaster*) override;
     void timerCallback() override;
+    using juce::AudioProcessorEditor::keyPressed;
+    bool keyPressed(const juce::KeyPress &key, juce::Component *component) override;
+    void loadCsdIfChanged();
+    juce::String commitCsd();
+    void updateJumpBox();
+    void showCompletions();
     private:
     CsoundVST3AudioProcessor& audioProcessor;
     juce::CodeDocument csd_document;
-    juce::CodeDocument messages_document;
     
     juce::TextButton openButton{"Open..."};
     juce::TextButton saveButton{"Save"};
@@ -138,22 +374,40 @@ public juce::Timer
     juce::TextButton playButton{"Play"};
     juce::TextButton stopButton{"Stop"};
     juce::TextButton findButton{"Find..."};
+    juce::TextButton settingsButton{"Settings..."};
     juce::TextButton aboutButton{"About"};
+    juce::ComboBox jumpBox;
     
     juce::Label statusBar;
+    juce::Label loadMeterLabel;
     juce::StretchableLayoutManager verticalLayout;
     juce::StretchableLayoutResizerBar divider;
     
     public:
     std::unique_ptr<CsoundTokeniser> csd_code_tokeniser;
     std::unique_ptr<juce::CodeEditorComponent> codeEditor;
-    std::unique_ptr<juce::CodeEditorComponent> messageLog;
+    std::unique_ptr<MessageLogView> messageLog;
 
 private:
     void buttonClicked(juce::Button* button) override;
     juce::TooltipWindow tooltipWindow { this }; // Enable tooltips
     std::unique_ptr<juce::FileChooser> fileChooser;
     juce::File csd_file;
+    int64_t loaded_csd_revision = -1;
+    int64_t reported_log_drops = 0;
+    std::unique_ptr<CsdIndex> csd_index;
+    /**
+     * The first line of each item in the jump box.
+     */
+    std::vector<int> jump_lines;
+    const OpcodeCatalogue *opcode_catalogue = nullptr;
+    /**
+     * Starts building the opcode catalogue when the first editor is opened,
+     * so that instances that are never edited, such as those a host scans,
+     * do not list opcodes.
+     */
+    juce::SharedResourcePointer<OpcodeCatalogue::Loader> opcode_catalogue_loader;
+    CsdLoader csd_loader {csd_document};
     
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR (CsoundVST3AudioProcessorEditor)
 };
@@ -1,6 +1,7 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
 #include "csoundvst3_version.h"
+#include "PluginState.h"
 #include <cassert>
 #include <csignal>
 
@@ -9,6 +10,28 @@
  */
 constexpr bool fifo_debug = false;
 
+/**
+ * The expected worst-case density of incoming and outgoing MIDI channel
+ * messages, used to size the MIDI FIFOs.
+ */
+constexpr int expected_midi_messages_per_second = 10000;
+constexpr int minimum_midi_fifo_capacity = 256;
+
+/**
+ * Csound messages are drained by the editor's timer, so this capacity does
+ * not depend on the audio block size.
+ */
+constexpr size_t log_ring_capacity = 256 * 1024;
+
+CsoundShard::CsoundShard(int index_) :
+    index(index_)
+{
+    job.work = [this]
+    {
+        result = csound.PerformKsmps();
+    };
+}
+
 /**
  * Permits a programmer to set a breakpoint in order to pause when
  * ThreadSanitiizer issues a report.
@@ -25,16 +48,21 @@ CsoundVST3AudioProcessor::CsoundVST3AudioProcessor()
                         .withInput  ("Input",  juce::AudioChannelSet::stereo(), true)
                         .withOutput ("Output", juce::AudioChannelSet::stereo(), true)
                         ),
-midi_input_fifo(65536),
-audio_input_fifo(65536),
-midi_output_fifo(65536),
-audio_output_fifo(65536),
-csound_messages_fifo(65536)
+log_ring(log_ring_capacity)
 {
+    // In pipelined mode, a block's load is the time that processBlock took
+    // to queue it, and the time that rendering it takes here.
+    render_job.work = [this]
+    {
+        auto begin = juce::Time::getHighResolutionTicks();
+        renderHostBlock(render_job_frames);
+        load_meter.record(LoadMeter::BLOCK, render_job_callback_ticks + juce::Time::getHighResolutionTicks() - begin, render_job_frames);
+    };
 }
 
 CsoundVST3AudioProcessor::~CsoundVST3AudioProcessor()
 {
+    waitForRender();
 }
 
 //==============================================================================
@@ -94,17 +122,56 @@ void CsoundVST3AudioProcessor::changeProgramName (int index, const juce::String&
 
 void CsoundVST3AudioProcessor::csoundMessage(const juce::String message)
 {
-    csound_messages_fifo.enqueue(message);
+    log(0, 0, message.toRawUTF8(), message.getNumBytesAsUTF8());
     DBG(message);
 }
 
+/**
+ * Writes a message to the log ring, through the log limiter. Safe on any
+ * thread: never blocks or allocates.
+ */
+void CsoundVST3AudioProcessor::log(int32_t level, int16_t source, const char *text, size_t length, bool was_truncated)
+{
+    log_limiter.write(log_ring, level, source, juce::Time::getHighResolutionTicks(), text, length, was_truncated);
+}
+
+/**
+ * Writes the log limiter's pending counts of repeated and suppressed
+ * messages; called by the editor's timer.
+ */
+void CsoundVST3AudioProcessor::flushLog()
+{
+    log_limiter.flush(log_ring, juce::Time::getHighResolutionTicks());
+}
+
+/**
+ * Called by Csound, usually on the audio thread, or on the RenderThreadPool
+ * for shards. Messages of types that are not logged are discarded first,
+ * before any formatting. Other messages are formatted into a stack buffer,
+ * just long enough for the longest log record, and copied into the log
+ * ring. A va_list cannot be kept for formatting later, so formatting is the
+ * only work not deferred to the editor's timer.
+ */
 void CsoundVST3AudioProcessor::csoundMessageCallback_(CSOUND *csound, int32_t level, const char *format, va_list valist)
 {
     auto host_data = csoundGetHostData(csound);
     auto processor = static_cast<CsoundVST3AudioProcessor *>(host_data);
-    char buffer[0x2000];
-    std::vsnprintf(&buffer[0], sizeof(buffer), format, valist);
-    processor->csoundMessage(buffer);
+    if ((processor->log_type_mask.load(std::memory_order_relaxed) & getLogTypeBit(level)) == 0)
+    {
+        return;
+    }
+    char buffer[LogRing::maximum_text_bytes + 1];
+    auto length = std::vsnprintf(&buffer[0], sizeof(buffer), format, valist);
+    if (length < 0)
+    {
+        return;
+    }
+    // vsnprintf returns the untruncated length; only what is in the buffer
+    // is passed on, and the log ring counts the message as truncated.
+    auto was_truncated = size_t(length) >= sizeof(buffer);
+    auto buffer_length = std::min(size_t(length), sizeof(buffer) - 1);
+    auto shard = processor->findShard(csound);
+    processor->log(level, int16_t(shard != nullptr ? shard->index : 0), buffer, buffer_length, was_truncated);
 }
 
 void CsoundVST3AudioProcessor::releaseResources()
@@ -154,10 +221,12 @@ int CsoundVST3AudioProcessor::midiRead(CSOUND *csound_, void *userData, unsigned
     int bytes_read = 0;
     auto csound_host_data = csoundGetHostData(csound_);
     CsoundVST3AudioProcessor *processor = static_cast<CsoundVST3AudioProcessor *>(csound_host_data);
+    auto shard = processor->findShard(csound_);
+    auto &midi_input_fifo = shard != nullptr ? shard->midi_input_fifo : processor->midi_input_fifo;
     int messages = 0;
     while (true)
     {
-        auto message = processor->midi_input_fifo.peek();
+        auto message = midi_input_fifo.peek();
         if (message == nullptr)
         {
             break;
@@ -194,7 +263,7 @@ int CsoundVST3AudioProcessor::midiRead(CSOUND *csound_, void *userData, unsigned
         {
             DBG("Not a MIDI channel message!");
         }
-        processor->midi_input_fifo.pop();
+        midi_input_fifo.pop();
     }
     return bytes_read;
 }
@@ -210,7 +279,12 @@ int CsoundVST3AudioProcessor::midiWrite(CSOUND *csound_, void *userData, const u
     MidiChannelMessage channel_message;
     channel_message.plugin_frame = processor->plugin_frame;
     channel_message.message = juce::MidiMessage(midi_buffer, midi_buffer_size, 0);
-    processor->midi_output_fifo.enqueue(channel_message);
+    auto shard = processor->findShard(csound_);
+    auto &midi_output_fifo = shard != nullptr ? shard->midi_output_fifo : processor->midi_output_fifo;
+    if (midi_output_fifo.try_enqueue(channel_message) == false)
+    {
+        processor->midi_output_fifo_overflows++;
+    }
     return result;
 }
 
@@ -263,19 +337,198 @@ template<typename T> void drain(moodycamel::ReaderWriterQueue<T> &queue)
         
     }
 }
+
+/**
+ * Ensures that the queue is empty and can hold at least capacity elements
+ * without allocating. The queue is re-allocated only if its capacity is too
+ * small or much too large. Must not be called on the audio thread.
+ */
+template<typename T> void reserve(moodycamel::ReaderWriterQueue<T> &queue, size_t capacity)
+{
+    if (queue.max_capacity() < capacity || queue.max_capacity() > 4 * capacity)
+    {
+        queue = moodycamel::ReaderWriterQueue<T>(capacity);
+    }
+    else
+    {
+        drain(queue);
+    }
+}
+
+template<typename T> size_t fifo_bytes(const moodycamel::ReaderWriterQueue<T> &queue)
+{
+    return queue.max_capacity() * sizeof(T);
+}
+
+/**
+ * Allocates the audio and MIDI FIFOs for at most one host block and one
+ * Csound block in flight, plus the pipeline latency if any, and reports the
+ * memory used by this instance.
+ * The audio thread uses try_enqueue, so FIFOs never allocate during
+ * performance; if a host exceeds the block size that it declared, the
+ * excess is dropped and counted.
+ */
+void CsoundVST3AudioProcessor::allocateFifos(int host_block_frames)
+{
+    const size_t frames_in_flight = size_t(std::max(host_block_frames, 1) + std::max(int(csound_frames), 1) + pipeline_latency_frames);
+    const size_t input_channels = size_t(std::max(host_input_channels, 1));
+    const size_t output_channels = size_t(std::max(std::max(host_output_channels, csound_output_channels), 1));
+    auto sample_rate = std::max(getSampleRate(), 1.);
+    const size_t midi_capacity = std::max(size_t(minimum_midi_fifo_capacity), size_t(std::ceil(expected_midi_messages_per_second * frames_in_flight / sample_rate)));
+    reserve(audio_input_fifo, frames_in_flight * input_channels);
+    reserve(audio_output_fifo, frames_in_flight * output_channels);
+    reserve(midi_input_fifo, midi_capacity);
+    reserve(midi_output_fifo, midi_capacity);
+    size_t shard_fifo_total = 0;
+    for (auto &shard : shards)
+    {
+        reserve(shard->midi_input_fifo, midi_capacity);
+        reserve(shard->midi_output_fifo, midi_capacity);
+        shard_fifo_total += fifo_bytes(shard->midi_input_fifo) + fifo_bytes(shard->midi_output_fifo);
+    }
+    audio_input_fifo_overflows = 0;
+    audio_output_fifo_overflows = 0;
+    midi_input_fifo_overflows = 0;
+    midi_output_fifo_overflows = 0;
+    log_ring.resetCounts();
+    log_limiter.reset();
+    auto fifo_total = fifo_bytes(audio_input_fifo) + fifo_bytes(audio_output_fifo) + fifo_bytes(midi_input_fifo) + fifo_bytes(midi_output_fifo) + log_ring.getCapacity() + shard_fifo_total;
+    csoundMessage(juce::String::formatted("FIFO capacity: audio in %zu, audio out %zu, MIDI in %zu, MIDI out %zu, log %zu bytes\n",
+                                          audio_input_fifo.max_capacity(), audio_output_fifo.max_capacity(), midi_input_fifo.max_capacity(), midi_output_fifo.max_capacity(), log_ring.getCapacity()));
+    csoundMessage(juce::String::formatted("Plugin instance memory: %zu bytes (FIFOs %zu bytes)\n", sizeof(*this) + fifo_total, fifo_total));
+}
+
+/**
+ * Reports any FIFO overflows since the FIFOs were allocated.
+ */
+void CsoundVST3AudioProcessor::reportFifoOverflows()
+{
+    int64_t overflows[] = { audio_input_fifo_overflows, audio_output_fifo_overflows, midi_input_fifo_overflows, midi_output_fifo_overflows, log_ring.getDroppedCount() };
+    if (std::accumulate(std::begin(overflows), std::end(overflows), int64_t(0)) > 0)
+    {
+        csoundMessage(juce::String::formatted("FIFO overflows: audio in %lld, audio out %lld, MIDI in %lld, MIDI out %lld, log %lld\n",
+                                              (long long)overflows[0], (long long)overflows[1], (long long)overflows[2], (long long)overflows[3], (long long)overflows[4]));
+    }
+    if (log_limiter.getRepeatedCount() > 0 || log_limiter.getSuppressedCount() > 0)
+    {
+        csoundMessage(juce::String::formatted("Log limiter: %lld repeated messages, %lld suppressed messages\n",
+                                              (long long)log_limiter.getRepeatedCount(), (long long)log_limiter.getSuppressedCount()));
+    }
+}
+/**
+ * Connects a Csound instance to this processor, and sets the options that
+ * the plugin overrides, before the csd is compiled. Used both for the
+ * processor's own csound, which is shard 0, and for the other shards.
+ */
+void CsoundVST3AudioProcessor::configureCsound(CsoundThreadedProcessor &instance, int shard)
+{
+    // (Re-)set the Csound message callback.
+    instance.SetHostData(this);
+    instance.SetMessageCallback(csoundMessageCallback_);
+    // Set up connections with the host.
+    instance.SetHostImplementedMIDIIO(1);
+    instance.SetHostImplementedAudioIO(1, 0);
+    instance.SetExternalMidiInOpenCallback(&CsoundVST3AudioProcessor::midiDeviceOpen);
+    instance.SetExternalMidiReadCallback(&CsoundVST3AudioProcessor::midiRead);
+    instance.SetExternalMidiInCloseCallback(&CsoundVST3AudioProcessor::midiDeviceClose);
+    instance.SetExternalMidiOutOpenCallback(&CsoundVST3AudioProcessor::midiDeviceOpen);
+    instance.SetExternalMidiWriteCallback(&CsoundVST3AudioProcessor::midiWrite);
+    instance.SetExternalMidiOutCloseCallback(&CsoundVST3AudioProcessor::midiDeviceClose);
+    /*
+     Message level for standard (terminal) output. Takes the sum of any of the following values:
+     1 = note amplitude messages
+     2 = samples out of range message
+     4 = warning messages
+     128 = print benchmark information
+     1024 = suppress deprecated messages
+     And exactly one of these to select note amplitude format:
+     0 = raw amplitudes, no colours
+     32 = dB, no colors
+     64 = dB, out of range highlighted with red
+     96 = dB, all colors
+     256 = raw, out of range highlighted with red
+     512 = raw, all colours
+     All messages can be suppressed by using message level 16.
+     */
+    // I suggest: 1 + 2 + 128 + 32 = 163.
+    char buffer[0x200];
+    // Overrride the csd's sample rate.
+    int host_sample_rate = getSampleRate();
+    snprintf(buffer, sizeof(buffer), "--sample-rate=%d", host_sample_rate);
+    instance.SetOption(buffer);
+    // Prevents funny characters from being displaned in Csound messages.
+    snprintf(buffer, sizeof(buffer), "-+msg_color=0");
+    instance.SetOption(buffer);
+    // Csound's parallel mode. The csd's own -j or --num-threads option, if
+    // any, overrides this, because <CsOptions> is read when the csd is
+    // compiled.
+    if (getCsoundThreadCount() > 1)
+    {
+        snprintf(buffer, sizeof(buffer), "--num-threads=%d", getCsoundThreadCount());
+        instance.SetOption(buffer);
+    }
+    // Every instance is told which shard it is, so that a csd can be written
+    // for any number of shards.
+    snprintf(buffer, sizeof(buffer), "--omacro:CSOUNDVST3_SHARD=%d", shard);
+    instance.SetOption(buffer);
+    snprintf(buffer, sizeof(buffer), "--smacro:CSOUNDVST3_SHARD=%d", shard);
+    instance.SetOption(buffer);
+    snprintf(buffer, sizeof(buffer), "--omacro:CSOUNDVST3_SHARDS=%d", shard_map.getShardCount());
+    instance.SetOption(buffer);
+    snprintf(buffer, sizeof(buffer), "--smacro:CSOUNDVST3_SHARDS=%d", shard_map.getShardCount());
+    instance.SetOption(buffer);
+}
+
+/**
+ * Creates and starts the shards after the first, if the csd declares any.
+ * All shards must have the same ksmps and channels as the processor's own
+ * csound; if any shard fails to start or differs, the processor performs
+ * all channels itself.
+ */
+void CsoundVST3AudioProcessor::startShards(const juce::String &csd_text, const juce::String &opcode_directory)
+{
+    shards.clear();
+    if (csd_text.length() == 0)
+    {
+        return;
+    }
+    for (int index = 1; index < shard_map.getShardCount(); ++index)
+    {
+        csoundMessage(juce::String::formatted("Starting shard %d...\n", index));
+        auto shard = std::make_unique<CsoundShard>(index);
+        shard->csound.RecreateWithOpcodeDirectory(opcode_directory);
+        configureCsound(shard->csound, index);
+        auto result = shard->csound.CompileCsdText(csd_text.toRawUTF8());
+        if (result == 0)
+        {
+            result = shard->csound.Start();
+        }
+        if (result != 0 ||
+            shard->csound.GetKsmps() != csound.GetKsmps() ||
+            shard->csound.GetNchnls() != csound.GetNchnls() ||
+            shard->csound.GetNchnlsInput() != csound.GetNchnlsInput())
+        {
+            csoundMessage(juce::String::formatted("Shard %d failed to start or does not match shard 0; shards are disabled.\n", index));
+            shards.clear();
+            return;
+        }
+        shards.push_back(std::move(shard));
+    }
+}
+
 /**
  * Compiles the csd and starts Csound.
  */
 void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerBlock)
 {
     juce::MessageManagerLock lock;
-    drain(csound_messages_fifo);
+    waitForRender();
+    log_ring.discard();
     auto editor = getActiveEditor();
     if (editor)
     {
         auto pluginEditor = reinterpret_cast<CsoundVST3AudioProcessorEditor *>(editor);
-        pluginEditor->messageLog->loadContent("");
-
+        pluginEditor->messageLog->clear();
     }
     csoundMessage("CsoundVST3AudioProcessor::prepareToPlay...\n");
     if (csoundIsPlaying == true)
@@ -285,18 +538,28 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
         csound.Cleanup();
         csound.Reset();
     }
-    // (Re-)set the Csound message callback.
-    csound.SetHostData(this);
-    csound.SetMessageCallback(csoundMessageCallback_);
-    // Set up connections with the host.
-    csound.SetHostImplementedMIDIIO(1);
-    csound.SetHostImplementedAudioIO(1, 0);
-    csound.SetExternalMidiInOpenCallback(&CsoundVST3AudioProcessor::midiDeviceOpen);
-    csound.SetExternalMidiReadCallback(&CsoundVST3AudioProcessor::midiRead);
-    csound.SetExternalMidiInCloseCallback(&CsoundVST3AudioProcessor::midiDeviceClose);
-    csound.SetExternalMidiOutOpenCallback(&CsoundVST3AudioProcessor::midiDeviceOpen);
-    csound.SetExternalMidiWriteCallback(&CsoundVST3AudioProcessor::midiWrite);
-    csound.SetExternalMidiOutCloseCallback(&CsoundVST3AudioProcessor::midiDeviceClose);
+    auto startup_begin = juce::Time::getMillisecondCounterHiRes();
+    auto resident_bytes_begin = OpcodeManifest::getResidentSetSizeBytes();
+    // The csd may be replaced from the plugin state at any time, so all of
+    // the instances are compiled from one copy of it.
+    juce::String csd_text;
+    {
+        juce::ScopedLock csd_scoped_lock(csd_lock);
+        csd_text = csd;
+    }
+    // If the csd declares an opcode manifest, Csound loads only the opcode
+    // libraries that it requires.
+    opcode_manifest.parse(csd_text);
+    auto opcode_directory = opcode_manifest.getRestrictedOpcodeDirectory(csd_text, [this](const juce::String &message) { csoundMessage(message); });
+    // If the csd declares shards, the other shards are started after this
+    // one.
+    shard_map.parse(csd_text);
+    if (hibernation.parseScore(csd_text) == false && hibernation_tail_seconds > 0.)
+    {
+        csoundMessage("Hibernation: the score's times cannot be read, so the instance does not hibernate.\n");
+    }
+    csound.RecreateWithOpcodeDirectory(opcode_directory);
+    configureCsound(csound, 0);
     auto midi_input_devices = juce::MidiInput::getAvailableDevices();
     auto input_device_count = midi_input_devices.size();
     for (auto device_index = 0; device_index < input_device_count; ++device_index)
@@ -315,43 +578,26 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
         message = message + "\n";
         csoundMessage(message);
     }
-    auto initial_delay_frames = csound.GetKsmps();
-    setLatencySamples(initial_delay_frames);
-    /*
-     Message level for standard (terminal) output. Takes the sum of any of the following values:
-     1 = note amplitude messages
-     2 = samples out of range message
-     4 = warning messages
-     128 = print benchmark information
-     1024 = suppress deprecated messages
-     And exactly one of these to select note amplitude format:
-     0 = raw amplitudes, no colours
-     32 = dB, no colors
-     64 = dB, out of range highlighted with red
-     96 = dB, all colors
-     256 = raw, out of range highlighted with red
-     512 = raw, all colours
-     All messages can be suppressed by using message level 16.
-     */
-    // I suggest: 1 + 2 + 128 + 32 = 163.
-    char buffer[0x200];
-    // Overrride the csd's sample rate.
-    int host_sample_rate = getSampleRate();
-    snprintf(buffer, sizeof(buffer), "--sample-rate=%d", host_sample_rate);
-    csound.SetOption(buffer);
-    // Prevents funny characters from being displaned in Csound messages.
-    snprintf(buffer, sizeof(buffer), "-+msg_color=0");
-    csound.SetOption(buffer);
+    csoundMessage(juce::String::formatted("Csound threads:         %3d%s\n", getCsoundThreadCount(), csound_thread_count == 0 ? " (automatic)" : ""));
+    bool has_audio_workgroup;
+    {
+        juce::ScopedLock workgroup_lock(audio_workgroup_lock);
+        has_audio_workgroup = bool(audio_workgroup);
+    }
+    if (has_audio_workgroup)
+    {
+        csoundMessage("Host audio workgroup:   available, but Csound's worker threads cannot join it.\n");
+    }
     // If there is a csd, compile it.
-    if (csd.length()  > 0) {
-        const char* csd_text = strdup(csd.toRawUTF8());
-        if (csd_text) {
-            auto result = csound.CompileCsdText(csd_text);
+    if (csd_text.length()  > 0) {
+        const char* csd_copy = strdup(csd_text.toRawUTF8());
+        if (csd_copy) {
+            auto result = csound.CompileCsdText(csd_copy);
             if (result != 0)
             {
                 csoundMessage("prepareToPlay: csound.CompileCsdText failed.\n");
             }
-            std::free((void *)csd_text);
+            std::free((void *)csd_copy);
             result = csound.Start();
             if (result != 0)
             {
@@ -359,6 +605,10 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
             }
         }
     }
+    startShards(csd_text, opcode_directory);
+    auto resident_bytes_end = OpcodeManifest::getResidentSetSizeBytes();
+    csoundMessage(juce::String::formatted("Csound startup:         %9.2f ms\n", juce::Time::getMillisecondCounterHiRes() - startup_begin));
+    csoundMessage(juce::String::formatted("Resident memory:        %9.2f MB (%+.2f MB)\n", resident_bytes_end / 1048576., (resident_bytes_end - resident_bytes_begin) / 1048576.));
     odbfs = csound.Get0dBFS();
     iodbfs = 1. / csound.Get0dBFS();
     host_input_channels  = getTotalNumInputChannels();
@@ -380,10 +630,39 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
     csoundMessage(juce::String::formatted("Csound output channels: %3d\n", csound_output_channels));
     csoundMessage(juce::String::formatted("Host output channels:   %3d\n", host_output_channels));
     csoundMessage(juce::String::formatted("Csound ksmps:           %3d\n", csound_frames));
-    drain(midi_input_fifo);
-    drain(audio_input_fifo);
-    drain(midi_output_fifo);
-    drain(audio_output_fifo);
+    csoundMessage(juce::String::formatted("Csound shards:          %3d\n", int(shards.size()) + 1));
+    if (shared_render_pool || shards.empty() == false)
+    {
+        if (render_pool == nullptr)
+        {
+            juce::ScopedLock workgroup_lock(audio_workgroup_lock);
+            render_pool = std::make_unique<juce::SharedResourcePointer<RenderThreadPool>>();
+            (*render_pool)->setWorkgroup(audio_workgroup);
+        }
+        csoundMessage(juce::String::formatted("Shared render threads:  %3d\n", (*render_pool)->getThreadCount()));
+    }
+    else
+    {
+        juce::ScopedLock workgroup_lock(audio_workgroup_lock);
+        render_pool.reset();
+    }
+    pipelined = shared_render_pool;
+    pipeline_latency_frames = pipelined ? samplesPerBlock : 0;
+    allocateFifos(samplesPerBlock);
+    hibernation.prepare(sampleRate, hibernation_tail_seconds);
+    load_meter.prepare(sampleRate);
+    polyphony_limiter.prepare(voice_limit, PolyphonyLimiter::Policy(voice_steal_policy.load()));
+    // In pipelined mode, the output FIFO starts with one host block of
+    // silence, which each processBlock call consumes while the block that
+    // it has just submitted is rendered.
+    for (int64_t frame = 0; frame < pipeline_latency_frames; ++frame)
+    {
+        for (int channel = 0; channel < host_output_channels; ++channel)
+        {
+            audio_output_fifo.try_enqueue(0.);
+        }
+    }
+    setLatencySamples(int(csound_frames + pipeline_latency_frames));
     // TODO: the following is a hack, better try something else.
     auto host_description = plugin_host_type.getHostDescription();
     DBG("Host description: " << host_description);
@@ -402,6 +681,7 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
         csoundMessage("CsoundVST3AudioProcessor::prepareToPlay: Csound is plqying.\n");
     }
     plugin_frame = 0;
+    kperiod_peak = 0;
     midi_input_sequence = 0;
  }
 
@@ -431,6 +711,11 @@ void CsoundVST3AudioProcessor::prepareToPlay (double sampleRate, int samplesPerB
  */
 void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<float>& host_audio_buffer, juce::MidiBuffer& host_midi_buffer)
 {
+    // In pipelined mode, the previous block must be rendered before this
+    // block's inputs are queued. The wait is part of the previous block's
+    // load, not of this one's.
+    waitForRender();
+    LoadMeter::ScopedTimer load_timer(load_meter, LoadMeter::BLOCK, host_audio_buffer.getNumSamples());
     auto play_head = getPlayHead();
     auto play_head_position = play_head->getPosition();
     if (csoundIsPlaying == false)
@@ -445,20 +730,23 @@ void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<float>& host_audi
         host_block_frame = *optional_time_in_samples;
     }
     synchronizeScore(play_head_position);
+    hibernation.observeTransport(play_head_position->getIsPlaying(), optional_time_in_samples ? *optional_time_in_samples : 0);
     juce::ScopedNoDenormals noDenormals;
     auto host_audio_buffer_frames = host_audio_buffer.getNumSamples();
-    host_block_begin = host_frame;
+    // The host block is counted on the plugin's clock, which Csound's
+    // kperiods and the MIDI FIFOs also use. Unlike the host's clock, it
+    // does not jump with the transport, and it stops while the instance
+    // hibernates, so that the MIDI that wakes the instance is read in
+    // Csound's next kperiod.
+    host_block_begin = plugin_frame;
     host_block_end = host_block_begin + host_audio_buffer_frames;
-    // Csound reads audio input from this buffer.
-    auto spin = csound.GetSpin();
-    // Csound writes audio output to this buffer.
-    auto spout = csound.GetSpout();
-    if (spout == nullptr)
+    if (csound.GetSpout() == nullptr)
     {
         csoundMessage("Null spout...\n");
         return;
     }
     auto host_audio_input_buffer = getBusBuffer(host_audio_buffer, true, 0);
+    hibernation.observeInput(host_audio_input_buffer.getMagnitude(0, host_audio_buffer_frames));
     auto host_audio_output_buffer = getBusBuffer(host_audio_buffer, false, 0);
     
     // Csound's spin and spout buffers are indexed [frame][channel].
@@ -478,6 +766,7 @@ void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<float>& host_audi
     // are handled, although these can of course include PRNs and NPRNs.
     int input_messages = 0;
     int output_messages = 0;
+    auto csound_active_voices = polyphony_limiter.isEnabled() ? getCsoundActiveVoices() : 0;
     for (const auto metadata : host_midi_buffer)
     {
         auto message = metadata.getMessage();
@@ -490,7 +779,20 @@ void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<float>& host_audi
         auto status = metadata.data[0];
         // We process only MIDI channel messages.
         if ((0x80 <= status) && (status <= 0xE0))        {
-             midi_input_fifo.enqueue(channel_message);
+            hibernation.observeMidi(message);
+            // If this note would exceed the voice limit, another note is
+            // stolen at the same time, or, if none can be, it is dropped.
+            MidiChannelMessage stolen_message = channel_message;
+            auto action = polyphony_limiter.process(message, csound_active_voices, stolen_message.message);
+            if (action == PolyphonyLimiter::STEAL)
+            {
+                hibernation.observeMidi(stolen_message.message);
+                enqueueMidiInput(stolen_message);
+            }
+            if (action != PolyphonyLimiter::DROP)
+            {
+                enqueueMidiInput(channel_message);
+            }
 #if defined(JUCE_DEBUG)
             if (fifo_debug == true)
             {
@@ -507,48 +809,34 @@ void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<float>& host_audi
         }
     }
     host_midi_buffer.clear();
+    // While hibernating, Csound is not called, and the host gets a buffer
+    // that is marked as silent. The plugin's clock does not advance, so
+    // Csound resumes where it stopped; the score has no events left to
+    // skip, because the instance does not hibernate before the last one.
+    if (hibernation.isHibernating())
+    {
+        hibernation.sleep(host_audio_buffer_frames);
+        host_frame += host_audio_buffer_frames;
+        host_audio_buffer.clear();
+        return;
+    }
     for (int host_audio_buffer_frame = 0; host_audio_buffer_frame < host_audio_buffer_frames; ++host_audio_buffer_frame)
     {
         for (int host_audio_buffer_channel = 0; host_audio_buffer_channel < host_input_channels; ++host_audio_buffer_channel)
         {
             auto sample = host_audio_buffer.getSample(host_audio_buffer_channel, host_audio_buffer_frame);
-            audio_input_fifo.enqueue(sample);
+            if (audio_input_fifo.try_enqueue(sample) == false)
+            {
+                audio_input_fifo_overflows++;
+            }
         }
     }
     host_audio_buffer.clear();
-    // FIFOs being loaded, now process.
-    // The host block pops audio input...
-    for (host_audio_buffer_frame = 0; host_audio_buffer_frame < host_audio_buffer_frames; ++host_audio_buffer_frame, ++host_frame, ++csound_frame, ++plugin_frame)
+    // FIFOs being loaded, now process. In pipelined mode, this block is
+    // rendered after the outputs of the previous block have been popped.
+    if (pipelined == false)
     {
-        int channel_index;
-        csound_frame = plugin_frame % csound_frames;
-        for (channel_index = 0; channel_index < host_input_channels; channel_index++)
-        {
-            float sample = 0;
-            if (audio_input_fifo.try_dequeue(sample))
-            {
-                sample = sample * odbfs;
-            }
-            spin[(csound_frame * csound_input_channels) + channel_index] = double(sample);
-        }
-        // ...until spin is full...
-        if (csound_frame == 0)
-        {
-            csound_block_begin = plugin_frame;
-            csound_block_end = plugin_frame + csound_frames;
-            auto result = csound.PerformKsmps();
-            if (result != 0) {
-                csoundIsPlaying = false;
-            }
-            for (int csound_block_frame = 0; csound_block_frame < csound_frames; ++csound_block_frame)
-            {
-                for (int csound_output_channel = 0; csound_output_channel < csound_output_channels; ++csound_output_channel)
-                {
-                    auto sample = iodbfs * spout[(csound_block_frame * csound_output_channels) + csound_output_channel];
-                    audio_output_fifo.enqueue(sample);
-                }
-            }
-        }
+        renderHostBlock(host_audio_buffer_frames);
     }
     // Processing of the host block being completed,
     // now pop from the output FIFOs until JUCE outputs are full.
@@ -559,22 +847,25 @@ void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<float>& host_audi
         {
             break;
         }
-        if ((message->plugin_frame >= host_block_begin) && (message->plugin_frame < host_block_end))
+        // Later messages are left for later blocks.
+        auto frame = message->plugin_frame + pipeline_latency_frames;
+        if (frame >= host_block_end)
         {
-            auto timestamp = message->plugin_frame - host_block_begin;
-            host_midi_buffer.addEvent(message->message, int(timestamp));
-            midi_output_fifo.pop();
+            break;
+        }
+        auto timestamp = std::max(frame - host_block_begin, int64_t(0));
+        host_midi_buffer.addEvent(message->message, int(timestamp));
+        midi_output_fifo.pop();
 #if defined(JUCE_DEBUG)
-            if (fifo_debug == true)
-            {
-                output_messages++;
-                char buffer[0x200];
-                std::snprintf(buffer, sizeof(buffer),
-                              "MIDI output to host#%5d: frame%8llu timestamp%8llu csound: begin%8llu frame %8llu %8llu end%8llu %s", output_messages, plugin_frame, timestamp, csound_block_begin, plugin_frame, csound_frame, csound_block_end, message->message.getDescription().toRawUTF8());
-                DBG(buffer);
-            }
-#endif
+        if (fifo_debug == true)
+        {
+            output_messages++;
+            char buffer[0x200];
+            std::snprintf(buffer, sizeof(buffer),
+                          "MIDI output to host#%5d: frame%8llu timestamp%8llu csound: begin%8llu frame %8llu %8llu end%8llu %s", output_messages, plugin_frame, timestamp, csound_block_begin, plugin_frame, csound_frame, csound_block_end, message->message.getDescription().toRawUTF8());
+            DBG(buffer);
         }
+#endif
     }
     for (int host_audio_buffer_frame = 0; host_audio_buffer_frame < host_audio_buffer_frames; ++host_audio_buffer_frame)
     {
@@ -593,6 +884,149 @@ void CsoundVST3AudioProcessor::processBlock (juce::AudioBuffer<float>& host_audi
             }
         }
     }
+    if (pipelined)
+    {
+        render_job_frames = host_audio_buffer_frames;
+        render_job_callback_ticks = load_timer.release();
+        (*render_pool)->submit(render_job);
+    }
+}
+
+/**
+ * Performs one kperiod of the processor's own csound and, in parallel on
+ * the RenderThreadPool, of each other shard. The shards receive the same
+ * audio input, and their outputs are summed into csound's spout. Returns
+ * the first non-zero result, if any.
+ */
+int CsoundVST3AudioProcessor::performKsmps()
+{
+    LoadMeter::ScopedTimer load_timer(load_meter, LoadMeter::KPERIOD, int(csound_frames));
+    if (shards.empty())
+    {
+        return csound.PerformKsmps();
+    }
+    auto spin = csound.GetSpin();
+    auto spin_samples = size_t(csound_frames * csound_input_channels);
+    for (auto &shard : shards)
+    {
+        std::copy(spin, spin + spin_samples, shard->csound.GetSpin());
+        (*render_pool)->submit(shard->job);
+    }
+    auto result = csound.PerformKsmps();
+    auto spout = csound.GetWritableSpout();
+    auto spout_samples = int(csound_frames * csound_output_channels);
+    for (auto &shard : shards)
+    {
+        (*render_pool)->wait(shard->job);
+        if (result == 0)
+        {
+            result = shard->result;
+        }
+        juce::FloatVectorOperations::add(spout, shard->csound.GetSpout(), spout_samples);
+        MidiChannelMessage message;
+        while (shard->midi_output_fifo.try_dequeue(message))
+        {
+            if (midi_output_fifo.try_enqueue(message) == false)
+            {
+                midi_output_fifo_overflows++;
+            }
+        }
+    }
+    return result;
+}
+
+/**
+ * Queues a MIDI channel message for the shard that performs its channel.
+ */
+void CsoundVST3AudioProcessor::enqueueMidiInput(const MidiChannelMessage &channel_message)
+{
+    auto shard = size_t(shard_map.getShard(channel_message.message.getChannel() - 1));
+    auto &fifo = (shard > 0 && shard <= shards.size()) ? shards[shard - 1]->midi_input_fifo : midi_input_fifo;
+    if (fifo.try_enqueue(channel_message) == false)
+    {
+        midi_input_fifo_overflows++;
+    }
+}
+
+/**
+ * Returns the number of active instrument instances that the csd reports
+ * in its CsoundVST3_active_voices control channel, summed over shards, or 0
+ * if it does not report them. For example, the csd may run, at every
+ * kperiod:
+ *
+ *     chnset active:k(0), "CsoundVST3_active_voices"
+ */
+int CsoundVST3AudioProcessor::getCsoundActiveVoices()
+{
+    int32_t error = 0;
+    auto active_voices = csoundGetControlChannel(csound.getCsoundHandle(), "CsoundVST3_active_voices", &error);
+    if (error != 0)
+    {
+        return 0;
+    }
+    for (auto &shard : shards)
+    {
+        active_voices += csoundGetControlChannel(shard->csound.getCsoundHandle(), "CsoundVST3_active_voices", &error);
+    }
+    return int(active_voices);
+}
+
+/**
+ * Pops host_audio_buffer_frames of queued audio input into Csound, calling
+ * PerformKsmps whenever spin is full, and pushes Csound's output onto the
+ * output FIFOs. Then reports the peak of that output to the hibernation.
+ * Runs in processBlock, or in pipelined mode, on the shared
+ * RenderThreadPool.
+ */
+void CsoundVST3AudioProcessor::renderHostBlock(int host_audio_buffer_frames)
+{
+    // Csound reads audio input from this buffer.
+    auto spin = csound.GetSpin();
+    // Csound writes audio output to this buffer.
+    auto spout = csound.GetSpout();
+    // The block plays the rest of the last kperiod, and all of any that
+    // are performed for it.
+    auto output_peak = kperiod_peak;
+    // The host block pops audio input...
+    for (host_audio_buffer_frame = 0; host_audio_buffer_frame < host_audio_buffer_frames; ++host_audio_buffer_frame, ++host_frame, ++csound_frame, ++plugin_frame)
+    {
+        int channel_index;
+        csound_frame = plugin_frame % csound_frames;
+        for (channel_index = 0; channel_index < host_input_channels; channel_index++)
+        {
+            float sample = 0;
+            if (audio_input_fifo.try_dequeue(sample))
+            {
+                sample = sample * odbfs;
+            }
+            spin[(csound_frame * csound_input_channels) + channel_index] = double(sample);
+        }
+        // ...until spin is full...
+        if (csound_frame == 0)
+        {
+            csound_block_begin = plugin_frame;
+            csound_block_end = plugin_frame + csound_frames;
+            auto result = performKsmps();
+            if (result != 0) {
+                csoundIsPlaying = false;
+            }
+            kperiod_peak = 0;
+            for (int csound_block_frame = 0; csound_block_frame < csound_frames; ++csound_block_frame)
+            {
+                for (int csound_output_channel = 0; csound_output_channel < csound_output_channels; ++csound_output_channel)
+                {
+                    auto sample = iodbfs * spout[(csound_block_frame * csound_output_channels) + csound_output_channel];
+                    kperiod_peak = std::max(kperiod_peak, float(std::abs(sample)));
+                    if (audio_output_fifo.try_enqueue(sample) == false)
+                    {
+                        audio_output_fifo_overflows++;
+                    }
+                }
+            }
+            output_peak = std::max(output_peak, kperiod_peak);
+        }
+    }
+    hibernation.observeOutput(output_peak, host_audio_buffer_frames, csound.GetScoreTime(), hibernation.isEnabled() ? getCsoundActiveVoices() : 0);
 }
 
 //==============================================================================
@@ -609,24 +1043,114 @@ juce::AudioProcessorEditor* CsoundVST3AudioProcessor::createEditor()
 //==============================================================================
 void CsoundVST3AudioProcessor::getStateInformation (juce::MemoryBlock& destData)
 {
-    juce::ValueTree state("CsoundVstState");
-    state.setProperty("csd", csd, nullptr);
-    juce::MemoryOutputStream stream(destData, false);
-    state.writeToStream(stream);
+    juce::ScopedLock lock(csd_lock);
+    PluginState::write(destData, csd, getSettings());
 }
 
+/**
+ * Does not touch the editor. If an editor is open, it loads the new csd
+ * when it receives the change message; otherwise, the csd is loaded into an
+ * editor only when one is created.
+ */
 void CsoundVST3AudioProcessor::setStateInformation (const void* data, int sizeInBytes)
 {
-    juce::MessageManagerLock lock;
-    juce::ValueTree state = juce::ValueTree::readFromData(data, static_cast<size_t>(sizeInBytes));
-    if (state.isValid() && state.hasType("CsoundVstState"))
-    {
-        csd = state.getProperty("csd", "").toString();
-        auto editor = getActiveEditor();
-        if (editor) {
-            auto pluginEditor = reinterpret_cast<CsoundVST3AudioProcessorEditor *>(editor);
-            pluginEditor->codeEditor->loadContent(csd);
+    juce::String new_csd;
+    juce::ValueTree settings;
+    juce::String error;
+    if (PluginState::read(data, sizeInBytes, new_csd, settings, error) == false)
+    {
+        // Older versions of CsoundVST3 saved the state as a ValueTree.
+        juce::ValueTree state = juce::ValueTree::readFromData(data, static_cast<size_t>(sizeInBytes));
+        if (state.isValid() == false || state.hasType("CsoundVstState") == false)
+        {
+            csoundMessage("setStateInformation: unrecognized state.\n");
+            return;
         }
+        new_csd = state.getProperty("csd", "").toString();
+    }
+    else if (error.isNotEmpty())
+    {
+        csoundMessage("setStateInformation: " + error + ".\n");
+        return;
+    }
+    {
+        juce::ScopedLock lock(csd_lock);
+        csd = new_csd;
+        csd_revision++;
+    }
+    applySettings(settings);
+    sendChangeMessage();
+}
+
+/**
+ * Returns the plugin's settings, apart from the csd, for saving in the
+ * plugin state.
+ */
+juce::ValueTree CsoundVST3AudioProcessor::getSettings() const
+{
+    juce::ValueTree settings("CsoundVST3Settings");
+    settings.setProperty("csoundThreadCount", csound_thread_count.load(), nullptr);
+    settings.setProperty("sharedRenderPool", shared_render_pool.load(), nullptr);
+    settings.setProperty("hibernationTailSeconds", hibernation_tail_seconds.load(), nullptr);
+    settings.setProperty("voiceLimit", voice_limit.load(), nullptr);
+    settings.setProperty("voiceStealPolicy", voice_steal_policy.load(), nullptr);
+    settings.setProperty("messageLogLines", message_log_lines.load(), nullptr);
+    settings.setProperty("logTypeMask", int(log_type_mask.load()), nullptr);
+    return settings;
+}
+
+void CsoundVST3AudioProcessor::applySettings(const juce::ValueTree &settings)
+{
+    csound_thread_count = int(settings.getProperty("csoundThreadCount", 0));
+    shared_render_pool = bool(settings.getProperty("sharedRenderPool", false));
+    hibernation_tail_seconds = double(settings.getProperty("hibernationTailSeconds", 0.));
+    voice_limit = int(settings.getProperty("voiceLimit", 0));
+    voice_steal_policy = juce::jlimit(0, 2, int(settings.getProperty("voiceStealPolicy", 0)));
+    message_log_lines = juce::jlimit(MessageLog::minimum_line_cap, MessageLog::maximum_line_cap,
+        int(settings.getProperty("messageLogLines", MessageLog::default_line_cap)));
+    log_type_mask = uint32_t(int(settings.getProperty("logTypeMask", int(all_log_types)))) & all_log_types;
+}
+
+/**
+ * By default, Csound uses a quarter of the machine's CPUs, but at most 4,
+ * leaving the rest for the host's own audio threads and other plugins.
+ */
+int CsoundVST3AudioProcessor::getDefaultCsoundThreadCount()
+{
+    return juce::jlimit(1, 4, juce::SystemStats::getNumCpus() / 4);
+}
+
+int CsoundVST3AudioProcessor::getCsoundThreadCount() const
+{
+    auto thread_count = csound_thread_count.load();
+    return thread_count > 0 ? thread_count : getDefaultCsoundThreadCount();
+}
+
+/**
+ * Csound creates its own worker threads and provides no way to run code on
+ * them, so they cannot join the host's workgroup. The workgroup is kept so
+ * that it can be reported, and is passed on to the shared
+ * RenderThreadPool, whose workers do join it.
+ */
+void CsoundVST3AudioProcessor::audioWorkgroupContextChanged(const juce::AudioWorkgroup &workgroup)
+{
+    juce::ScopedLock workgroup_lock(audio_workgroup_lock);
+    audio_workgroup = workgroup;
+    if (render_pool != nullptr)
+    {
+        (*render_pool)->setWorkgroup(workgroup);
+    }
+}
+
+/**
+ * In pipelined mode, returns when the last submitted host block has been
+ * rendered; otherwise, returns at once.
+ */
+void CsoundVST3AudioProcessor::waitForRender()
+{
+    if (render_pool != nullptr)
+    {
+        (*render_pool)->wait(render_job);
     }
 }
 
@@ -649,10 +1173,13 @@ void CsoundVST3AudioProcessor::play()
 void CsoundVST3AudioProcessor::stop()
 {
     suspendProcessing(true);
+    waitForRender();
+    reportFifoOverflows();
     csoundIsPlaying = false;
     csound.Stop();
     csound.Cleanup();
     csound.Reset();
+    shards.clear();
 }
 
 
@@ -8,6 +8,15 @@
 #include "csound_threaded.hpp"
 #include "readerwriterqueue.h"
 #include "csoundvst3_version.h"
+#include "OpcodeManifest.h"
+#include "RenderThreadPool.h"
+#include "ShardMap.h"
+#include "Hibernation.h"
+#include "PolyphonyLimiter.h"
+#include "LogRing.h"
+#include "LogLimiter.h"
+#include "MessageLog.h"
+#include "LoadMeter.h"
 
 #include <cstdint>
 #include <iostream>
@@ -89,6 +98,11 @@ public:
         csoundSetScoreOffsetSeconds(csound, static_cast<MYFLT>(timeSeconds));
     }
 
+    double GetScoreTime()
+    {
+        return csoundGetScoreTime(csound);
+    }
+
 #if defined(CSOUND_VERSION_MAJOR) && (CSOUND_VERSION_MAJOR >= 7)
     int32_t GetKsmps() override
     {
@@ -136,6 +150,17 @@ public:
         return csoundGetSpout(csound);
     }
 
+    /**
+     * Spout, for adding the shards' output to it. Csound 7 returns spout
+     * as const, but Csound only clears and fills it within PerformKsmps, and
+     * the processor reads it only after; so adding to it between kperiods is
+     * safe.
+     */
+    MYFLT *GetWritableSpout()
+    {
+        return const_cast<MYFLT *>(csoundGetSpout(csound));
+    }
+
     MYFLT GetSr()
     {
         return csoundGetSr(csound);
@@ -165,6 +190,47 @@ public:
     {
         csoundReset(csound);
     }
+
+    /**
+     * Csound 7 loads plugin opcode libraries when the instance is created,
+     * so restricting them means destroying and re-creating the instance.
+     * An empty opcodedir restores Csound's default plugin directory. Does
+     * nothing if the directory has not changed.
+     */
+    void RecreateWithOpcodeDirectory(const juce::String &opcodedir)
+    {
+        if (opcodedir == opcode_directory)
+        {
+            return;
+        }
+        opcode_directory = opcodedir;
+        csoundDestroy(csound);
+        csound = OpcodeManifest::createCsound(opcode_directory.isEmpty() ? nullptr : opcode_directory.toRawUTF8());
+    }
+
+private:
+    juce::String opcode_directory;
+#else
+    /**
+     * Csound 6 loads plugin opcode libraries when the instance is created,
+     * as Csound 7 does, but also when it is reset, and then from the default
+     * directory; so an instance restricted to a directory is re-created
+     * every time. An empty opcodedir restores Csound's default plugin
+     * directory.
+     */
+    void RecreateWithOpcodeDirectory(const juce::String &opcodedir)
+    {
+        if (opcodedir.isEmpty() && opcode_directory.isEmpty())
+        {
+            return;
+        }
+        opcode_directory = opcodedir;
+        csoundDestroy(csound);
+        csound = OpcodeManifest::createCsound(opcode_directory.isEmpty() ? nullptr : opcode_directory.toRawUTF8());
+    }
+
+private:
+    juce::String opcode_directory;
 #endif
 };
 
@@ -177,6 +243,25 @@ public:
     juce::MidiMessage message;
 };
 
+/**
+ * A Csound instance, compiled from the same csd as the processor's own
+ * csound, that performs the MIDI channels that the ShardMap assigns to it.
+ * Shards are rendered on the RenderThreadPool during the processor's own
+ * kperiod, and their output is summed into the processor's spout. Because
+ * shards run concurrently, each has its own MIDI FIFOs.
+ */
+class CsoundShard
+{
+public:
+    CsoundShard(int index);
+    int index;
+    CsoundThreadedProcessor csound;
+    moodycamel::ReaderWriterQueue<MidiChannelMessage> midi_input_fifo;
+    moodycamel::ReaderWriterQueue<MidiChannelMessage> midi_output_fifo;
+    RenderThreadPool::Job job;
+    std::atomic<int> result {0};
+};
+
 class CsoundVST3AudioProcessor : public juce::AudioProcessor, public juce::ChangeBroadcaster
 {
 public:
@@ -208,9 +293,16 @@ public:
 
     void getStateInformation(juce::MemoryBlock &destData) override;
     void setStateInformation(const void *data, int sizeInBytes) override;
+    juce::ValueTree getSettings() const;
+    void applySettings(const juce::ValueTree &settings);
+    static int getDefaultCsoundThreadCount();
+    int getCsoundThreadCount() const;
+    void audioWorkgroupContextChanged(const juce::AudioWorkgroup &workgroup) override;
 
     static void csoundMessageCallback_(CSOUND *, int32_t, const char *, va_list);
     void csoundMessage(const juce::String message);
+    void log(int32_t level, int16_t source, const char *text, size_t length, bool was_truncated = false);
+    void flushLog();
 
     static int midiDeviceOpen(CSOUND *csound, void **userData, const char *devName);
     static int midiDeviceClose(CSOUND *csound, void *userData);
@@ -220,14 +312,93 @@ public:
 
     void play();
     void stop();
+    void allocateFifos(int host_block_frames);
+    void reportFifoOverflows();
+    void renderHostBlock(int host_audio_buffer_frames);
+    void waitForRender();
+    void configureCsound(CsoundThreadedProcessor &instance, int shard);
+    void startShards(const juce::String &csd_text, const juce::String &opcode_directory);
+    int performKsmps();
+    void enqueueMidiInput(const MidiChannelMessage &channel_message);
+    int getCsoundActiveVoices();
+    /**
+     * Returns the shard that owns the Csound instance, or nullptr if it is
+     * the processor's own csound.
+     */
+    CsoundShard *findShard(CSOUND *instance)
+    {
+        for (auto &shard : shards)
+        {
+            if (shard->csound.getCsoundHandle() == instance)
+            {
+                return shard.get();
+            }
+        }
+        return nullptr;
+    }
 
     CsoundThreadedProcessor csound;
     std::atomic<bool> csoundIsPlaying = false;
     std::function<void(const juce::String &)> messageCallback;
     juce::String csd;
+    /**
+     * Guards csd when it is replaced from the plugin state; csd_revision
+     * is incremented whenever that happens, so that an open editor can load
+     * the new csd.
+     */
+    juce::CriticalSection csd_lock;
+    std::atomic<int64_t> csd_revision {};
     juce::PluginHostType plugin_host_type;
+    /**
+     * The number of threads for Csound's parallel mode, or 0 for the
+     * default. Takes effect when Csound is next compiled.
+     */
+    std::atomic<int> csound_thread_count {0};
+    /**
+     * The host may change the workgroup from any thread, so
+     * audio_workgroup_lock guards audio_workgroup, and the creation and
+     * release of render_pool, to which the workgroup is passed on.
+     */
+    juce::AudioWorkgroup audio_workgroup;
+    juce::CriticalSection audio_workgroup_lock;
+    /**
+     * If true, each host block is rendered on the process-wide
+     * RenderThreadPool while the host goes on to other plugins, and output
+     * is delayed by one host block. Takes effect when Csound is next
+     * compiled.
+     */
+    std::atomic<bool> shared_render_pool {false};
+    /**
+     * Seconds of silence, with no notes held, after which the instance
+     * hibernates, or 0 to never hibernate. Takes effect when Csound is next
+     * compiled.
+     */
+    std::atomic<double> hibernation_tail_seconds {0.};
+    /**
+     * The maximum number of notes performed at once, or 0 for no limit, and
+     * the PolyphonyLimiter::Policy for stealing notes. Take effect when
+     * Csound is next compiled.
+     */
+    std::atomic<int> voice_limit {0};
+    std::atomic<int> voice_steal_policy {PolyphonyLimiter::STEAL_OLDEST};
+    /**
+     * The most lines that the editor's message log keeps.
+     */
+    std::atomic<int> message_log_lines {MessageLog::default_line_cap};
+    /**
+     * Which types of Csound message are logged, one bit per type, that is,
+     * per (level & CSOUNDMSG_TYPE_MASK) >> 12. Messages of other types are
+     * discarded before they are formatted.
+     */
+    static constexpr uint32_t all_log_types = 0xff;
+    static constexpr uint32_t getLogTypeBit(int32_t level)
+    {
+        return 1u << ((level & CSOUNDMSG_TYPE_MASK) >> 12);
+    }
+    std::atomic<uint32_t> log_type_mask {all_log_types};
 
 private:
+    OpcodeManifest opcode_manifest;
     double odbfs {};
     double iodbfs {};
 
@@ -249,17 +420,49 @@ private:
 
     int64_t csound_block_begin {};
     int64_t csound_block_end {};
+    /**
+     * The peak of Csound's output in the last kperiod, relative to 0dBFS.
+     */
+    float kperiod_peak {};
     int64_t host_block_begin {};
     int64_t host_block_end {};
     int64_t midi_input_sequence {};
 
+    std::unique_ptr<juce::SharedResourcePointer<RenderThreadPool>> render_pool;
+    RenderThreadPool::Job render_job;
+    int render_job_frames {};
+    int64_t render_job_callback_ticks {};
+    bool pipelined {};
+    int64_t pipeline_latency_frames {};
+
+    ShardMap shard_map;
+    Hibernation hibernation;
+    PolyphonyLimiter polyphony_limiter;
+    /**
+     * The shards after the first, which is csound.
+     */
+    std::vector<std::unique_ptr<CsoundShard>> shards;
+
     moodycamel::ReaderWriterQueue<MidiChannelMessage> midi_input_fifo;
     moodycamel::ReaderWriterQueue<double> audio_input_fifo;
     moodycamel::ReaderWriterQueue<MidiChannelMessage> midi_output_fifo;
     moodycamel::ReaderWriterQueue<double> audio_output_fifo;
+    std::atomic<int64_t> midi_input_fifo_overflows {};
+    std::atomic<int64_t> audio_input_fifo_overflows {};
+    std::atomic<int64_t> midi_output_fifo_overflows {};
+    std::atomic<int64_t> audio_output_fifo_overflows {};
 
 public:
-    moodycamel::ReaderWriterQueue<juce::String> csound_messages_fifo;
+    /**
+     * Csound and plugin messages, read by the editor's timer.
+     */
+    LogRing log_ring;
+    LogLimiter log_limiter;
+    /**
+     * The load of processBlock and of each kperiod, read by the editor's
+     * timer.
+     */
+    LoadMeter load_meter;
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(CsoundVST3AudioProcessor)
 };
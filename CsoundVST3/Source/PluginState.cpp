@@ -0,0 +1,139 @@
+#include "PluginState.h"
+#include <list>
+#include <mutex>
+
+/**
+ * The process-wide cache of compressed csds, most recently used first.
+ * Entries hold a reference to the csd text, so the address of the text
+ * identifies an entry for as long as the entry is cached.
+ */
+struct CachedCsd
+{
+    juce::String csd;
+    uint64_t hash = 0;
+    int64_t size = 0;
+    juce::MemoryBlock compressed;
+};
+
+static std::mutex csd_cache_mutex;
+static std::list<CachedCsd> csd_cache;
+constexpr size_t csd_cache_capacity = 64;
+
+static void cacheCsd(CachedCsd &&entry)
+{
+    csd_cache.push_front(std::move(entry));
+    if (csd_cache.size() > csd_cache_capacity)
+    {
+        csd_cache.pop_back();
+    }
+}
+
+uint64_t PluginState::hash(const juce::String &csd)
+{
+    uint64_t result = 0xcbf29ce484222325ull;
+    for (auto p = csd.toRawUTF8(); *p != 0; ++p)
+    {
+        result ^= uint8_t(*p);
+        result *= 0x100000001b3ull;
+    }
+    return result;
+}
+
+void PluginState::write(juce::MemoryBlock &destination, const juce::String &csd, const juce::ValueTree &settings)
+{
+    juce::MemoryOutputStream stream(destination, false);
+    stream.writeInt(magic);
+    stream.writeInt(version);
+    juce::MemoryOutputStream settings_stream;
+    settings.writeToStream(settings_stream);
+    stream.writeInt(int(settings_stream.getDataSize()));
+    stream.write(settings_stream.getData(), settings_stream.getDataSize());
+    std::lock_guard<std::mutex> lock(csd_cache_mutex);
+    auto it = std::find_if(csd_cache.begin(), csd_cache.end(), [&csd](const CachedCsd &entry)
+    {
+        return entry.csd.getCharPointer() == csd.getCharPointer();
+    });
+    if (it == csd_cache.end())
+    {
+        CachedCsd entry;
+        entry.csd = csd;
+        entry.hash = hash(csd);
+        entry.size = int64_t(csd.getNumBytesAsUTF8());
+        {
+            juce::MemoryOutputStream compressed_stream(entry.compressed, false);
+            juce::GZIPCompressorOutputStream compressor(compressed_stream, 6);
+            compressor.write(csd.toRawUTF8(), size_t(entry.size));
+            compressor.flush();
+        }
+        cacheCsd(std::move(entry));
+    }
+    else
+    {
+        csd_cache.splice(csd_cache.begin(), csd_cache, it);
+    }
+    const auto &entry = csd_cache.front();
+    stream.writeInt64(int64_t(entry.hash));
+    stream.writeInt64(entry.size);
+    stream.writeInt64(int64_t(entry.compressed.getSize()));
+    stream.write(entry.compressed.getData(), entry.compressed.getSize());
+}
+
+bool PluginState::read(const void *data, int size, juce::String &csd, juce::ValueTree &settings, juce::String &error)
+{
+    juce::MemoryInputStream stream(data, size_t(size), false);
+    if (size < 8 || stream.readInt() != magic)
+    {
+        return false;
+    }
+    auto state_version = stream.readInt();
+    if (state_version < 1 || state_version > version)
+    {
+        error = juce::String::formatted("unsupported state version %d", state_version);
+        return true;
+    }
+    auto settings_size = stream.readInt();
+    if (settings_size < 0 || settings_size > stream.getNumBytesRemaining())
+    {
+        error = "truncated settings";
+        return true;
+    }
+    juce::MemoryBlock settings_data;
+    stream.readIntoMemoryBlock(settings_data, settings_size);
+    auto csd_hash = uint64_t(stream.readInt64());
+    auto csd_size = stream.readInt64();
+    auto compressed_size = stream.readInt64();
+    if (csd_size < 0 || compressed_size < 0 || compressed_size > stream.getNumBytesRemaining())
+    {
+        error = "truncated csd";
+        return true;
+    }
+    settings = juce::ValueTree::readFromData(settings_data.getData(), settings_data.getSize());
+    std::lock_guard<std::mutex> lock(csd_cache_mutex);
+    auto it = std::find_if(csd_cache.begin(), csd_cache.end(), [csd_hash, csd_size](const CachedCsd &entry)
+    {
+        return entry.hash == csd_hash && entry.size == csd_size;
+    });
+    if (it != csd_cache.end())
+    {
+        csd_cache.splice(csd_cache.begin(), csd_cache, it);
+        csd = csd_cache.front().csd;
+        return true;
+    }
+    CachedCsd entry;
+    stream.readIntoMemoryBlock(entry.compressed, compressed_size);
+    juce::MemoryInputStream compressed_stream(entry.compressed, false);
+    juce::GZIPDecompressorInputStream decompressor(&compressed_stream, false, juce::GZIPDecompressorInputStream::zlibFormat, csd_size);
+    juce::MemoryBlock text;
+    decompressor.readIntoMemoryBlock(text, csd_size);
+    entry.csd = juce::String::fromUTF8(static_cast<const char *>(text.getData()), int(text.getSize()));
+    entry.hash = hash(entry.csd);
+    entry.size = int64_t(text.getSize());
+    if (entry.hash != csd_hash || entry.size != csd_size)
+    {
+        error = "the csd does not match its hash";
+        return true;
+    }
+    csd = entry.csd;
+    cacheCsd(std::move(entry));
+    return true;
+}
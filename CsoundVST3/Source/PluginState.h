@@ -0,0 +1,40 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <juce_data_structures/juce_data_structures.h>
+
+#include <cstdint>
+
+/**
+ * Reads and writes the plugin state in a versioned binary format:
+ *
+ *     int32   magic ("CVS3")
+ *     int32   format version
+ *     int32   size of settings, then the settings as a binary ValueTree
+ *     int64   hash of the csd's UTF-8 text
+ *     int64   size of the csd's UTF-8 text
+ *     int64   size of the compressed csd, then the deflated csd
+ *
+ * Projects often contain many instances of the same large csd, so the
+ * compressed text is cached per process and keyed by content hash. Saving
+ * an unchanged csd, or loading a csd that another instance has already
+ * loaded, then neither compresses nor decompresses, and instances loaded
+ * from the same csd share one copy of its text.
+ */
+class PluginState
+{
+public:
+    static constexpr int32_t magic = 0x33535643;
+    static constexpr int32_t version = 1;
+    static void write(juce::MemoryBlock &destination, const juce::String &csd, const juce::ValueTree &settings);
+    /**
+     * Returns false if the data is not in this format. Otherwise, returns
+     * true and replaces csd and settings, or sets error if the data is in
+     * this format but cannot be read.
+     */
+    static bool read(const void *data, int size, juce::String &csd, juce::ValueTree &settings, juce::String &error);
+    /**
+     * 64-bit FNV-1a hash of the csd's UTF-8 text.
+     */
+    static uint64_t hash(const juce::String &csd);
+};
@@ -0,0 +1,148 @@
+#include "PolyphonyLimiter.h"
+
+void PolyphonyLimiter::prepare(int voice_limit_, Policy policy_)
+{
+    voice_limit = std::max(voice_limit_, 0);
+    policy = policy_;
+    next_order = 0;
+    voice_count = 0;
+    sustain.fill(false);
+}
+
+PolyphonyLimiter::Action PolyphonyLimiter::process(const juce::MidiMessage &message, int csound_active_voices, juce::MidiMessage &note_off)
+{
+    auto channel = message.getChannel() - 1;
+    if (voice_limit == 0 || channel < 0 || channel > 15)
+    {
+        return PASS;
+    }
+    if (message.isNoteOn())
+    {
+        auto key = message.getNoteNumber();
+        auto index = find(channel, key);
+        if (index != -1)
+        {
+            // A retriggered note keeps its voice.
+            voices[size_t(index)].velocity = message.getVelocity();
+            voices[size_t(index)].sustained = false;
+            voices[size_t(index)].order = next_order++;
+            return PASS;
+        }
+        auto action = PASS;
+        if (std::max(voice_count, csound_active_voices) >= voice_limit && voice_count > 0)
+        {
+            auto victim = chooseVictim();
+            if (victim == -1)
+            {
+                return DROP;
+            }
+            note_off = juce::MidiMessage::noteOff(voices[size_t(victim)].channel + 1, voices[size_t(victim)].key);
+            remove(victim);
+            action = STEAL;
+        }
+        if (voice_count < maximum_voices)
+        {
+            voices[size_t(voice_count++)] = { uint8_t(channel), uint8_t(key), message.getVelocity(), false, next_order++ };
+        }
+        return action;
+    }
+    if (message.isNoteOff())
+    {
+        auto index = find(channel, message.getNoteNumber());
+        if (index != -1)
+        {
+            if (sustain[size_t(channel)])
+            {
+                voices[size_t(index)].sustained = true;
+            }
+            else
+            {
+                remove(index);
+            }
+        }
+    }
+    else if (message.isSustainPedalOn())
+    {
+        sustain[size_t(channel)] = true;
+    }
+    else if (message.isSustainPedalOff())
+    {
+        sustain[size_t(channel)] = false;
+        for (int index = voice_count - 1; index >= 0; --index)
+        {
+            if (voices[size_t(index)].channel == channel && voices[size_t(index)].sustained)
+            {
+                remove(index);
+            }
+        }
+    }
+    else if (message.isAllNotesOff() || message.isAllSoundOff())
+    {
+        for (int index = voice_count - 1; index >= 0; --index)
+        {
+            if (voices[size_t(index)].channel == channel)
+            {
+                remove(index);
+            }
+        }
+    }
+    return PASS;
+}
+
+void PolyphonyLimiter::remove(int index)
+{
+    voices[size_t(index)] = voices[size_t(--voice_count)];
+}
+
+int PolyphonyLimiter::find(int channel, int key) const
+{
+    for (int index = 0; index < voice_count; ++index)
+    {
+        if (voices[size_t(index)].channel == channel && voices[size_t(index)].key == key)
+        {
+            return index;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Returns the index of the voice to steal, or -1 if every voice is held
+ * only by the sustain pedal.
+ */
+int PolyphonyLimiter::chooseVictim() const
+{
+    int victim = -1;
+    for (int index = 0; index < voice_count; ++index)
+    {
+        const auto &voice = voices[size_t(index)];
+        if (voice.sustained)
+        {
+            continue;
+        }
+        if (victim == -1)
+        {
+            victim = index;
+            continue;
+        }
+        const auto &best = voices[size_t(victim)];
+        bool better = false;
+        if (policy == STEAL_QUIETEST)
+        {
+            better = voice.velocity < best.velocity || (voice.velocity == best.velocity && voice.order < best.order);
+        }
+        else if (policy == STEAL_LOWEST_PRIORITY)
+        {
+            better = voice.channel > best.channel || (voice.channel == best.channel && voice.order < best.order);
+        }
+        else
+        {
+            better = voice.order < best.order;
+        }
+        if (better)
+        {
+            victim = index;
+        }
+    }
+    return victim;
+}
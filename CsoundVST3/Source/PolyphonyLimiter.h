@@ -0,0 +1,96 @@
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Bounds the number of notes that Csound performs, so that dense MIDI
+ * input cannot create instrument instances without limit.
+ *
+ * The limiter tracks the notes that are sounding from the incoming MIDI
+ * stream, counting notes released while the sustain pedal is down until it
+ * is lifted. When a new note would exceed the voice limit, it steals a
+ * voice by sending a note-off for it just before the new note-on. Notes
+ * held only by the sustain pedal are never stolen, because their note-off
+ * has already been sent and another would not release them; if every
+ * voice is held by the pedal, the new note is dropped instead. Csound
+ * itself may report a larger number of active instances, for example
+ * because of release tails, which also counts against the limit.
+ */
+class PolyphonyLimiter
+{
+public:
+    enum Policy
+    {
+        /**
+         * Steals the note that started first.
+         */
+        STEAL_OLDEST = 0,
+        /**
+         * Steals the note with the lowest velocity.
+         */
+        STEAL_QUIETEST,
+        /**
+         * Steals a note on the highest MIDI channel, that is, channel 1 has
+         * the highest priority; the oldest such note is stolen first.
+         */
+        STEAL_LOWEST_PRIORITY,
+    };
+    enum Action
+    {
+        /**
+         * Sends the message.
+         */
+        PASS = 0,
+        /**
+         * Sends the note-off for a stolen voice, then the message.
+         */
+        STEAL,
+        /**
+         * Does not send the note-on, because no voice can be stolen for it.
+         */
+        DROP,
+    };
+    /**
+     * Resets the state; a voice limit of 0 disables the limiter.
+     */
+    void prepare(int voice_limit, Policy policy);
+    bool isEnabled() const
+    {
+        return voice_limit > 0;
+    }
+    /**
+     * Updates the sounding notes for the message, and returns what to do
+     * with it. If the message is a note-on that would exceed the limit,
+     * given the number of instances that Csound reports as active (or 0 if
+     * it does not report them), returns STEAL with the note-off to send
+     * before the message, or DROP.
+     */
+    Action process(const juce::MidiMessage &message, int csound_active_voices, juce::MidiMessage &note_off);
+    int getVoiceCount() const
+    {
+        return voice_count;
+    }
+
+private:
+    struct Voice
+    {
+        uint8_t channel;
+        uint8_t key;
+        uint8_t velocity;
+        bool sustained;
+        uint64_t order;
+    };
+    void remove(int index);
+    int find(int channel, int key) const;
+    int chooseVictim() const;
+    static constexpr int maximum_voices = 16 * 128;
+    int voice_limit = 0;
+    Policy policy = STEAL_OLDEST;
+    uint64_t next_order = 0;
+    int voice_count = 0;
+    std::array<Voice, maximum_voices> voices {};
+    std::array<bool, 16> sustain {};
+};
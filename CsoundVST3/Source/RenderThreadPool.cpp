@@ -0,0 +1,172 @@
+#include "RenderThreadPool.h"
+
+#include <thread>
+
+class RenderThreadPool::Worker : public juce::Thread
+{
+public:
+    Worker(RenderThreadPool &pool_, size_t index_)
+        : juce::Thread(juce::String::formatted("CsoundVST3 render %d", int(index_))), pool(pool_), index(index_)
+    {
+    }
+    void run() override
+    {
+        while (true)
+        {
+            pool.jobs_available.acquire();
+            if (pool.stopping)
+            {
+                break;
+            }
+            joinWorkgroup();
+            // Another worker may already have taken the job that was
+            // announced, and this one may then miss a job that is queued
+            // while it looks; so it runs jobs until the queues are empty,
+            // because no other thread takes them.
+            while (pool.runQueuedJob(index))
+            {
+            }
+        }
+        workgroup_token.reset();
+    }
+private:
+    void joinWorkgroup()
+    {
+        auto generation = pool.workgroup_generation.load(std::memory_order_acquire);
+        if (generation == workgroup_generation)
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(pool.workgroup_mutex);
+        workgroup_token.reset();
+        if (pool.workgroup)
+        {
+            pool.workgroup.join(workgroup_token);
+        }
+        workgroup_generation = generation;
+    }
+    RenderThreadPool &pool;
+    size_t index;
+    int workgroup_generation = 0;
+    juce::WorkgroupToken workgroup_token;
+};
+
+RenderThreadPool::RenderThreadPool()
+{
+    // One CPU is left for the host's own audio thread, which also renders
+    // while it waits.
+    auto thread_count = size_t(std::max(1, juce::SystemStats::getNumCpus() - 1));
+    for (size_t index = 0; index < thread_count; ++index)
+    {
+        queues.push_back(std::make_unique<bounded_queue<Job *>>(queue_capacity));
+    }
+    for (size_t index = 0; index < thread_count; ++index)
+    {
+        workers.push_back(std::make_unique<Worker>(*this, index));
+        if (workers.back()->startRealtimeThread(juce::Thread::RealtimeOptions{}) == false)
+        {
+            workers.back()->startThread(juce::Thread::Priority::highest);
+        }
+    }
+}
+
+RenderThreadPool::~RenderThreadPool()
+{
+    stopping = true;
+    jobs_available.release(std::ptrdiff_t(workers.size()));
+    for (auto &worker : workers)
+    {
+        worker->stopThread(-1);
+    }
+    // Releases the entries of jobs that were run by the threads waiting for
+    // them, so that the jobs can be destroyed.
+    Job *job = nullptr;
+    for (auto &queue : queues)
+    {
+        while (queue->try_pop(job))
+        {
+            job->queued.fetch_sub(1, std::memory_order_release);
+        }
+    }
+}
+
+RenderThreadPool::Job::~Job()
+{
+    while (queued.load(std::memory_order_acquire) != 0)
+    {
+        std::this_thread::yield();
+    }
+}
+
+bool RenderThreadPool::Job::tryRun()
+{
+    if (claimed.exchange(true, std::memory_order_acq_rel))
+    {
+        return false;
+    }
+    work();
+    done.store(true, std::memory_order_release);
+    return true;
+}
+
+void RenderThreadPool::submit(Job &job)
+{
+    job.done.store(false, std::memory_order_relaxed);
+    // Released, because a worker may take an earlier entry for the job.
+    job.claimed.store(false, std::memory_order_release);
+    job.queued.fetch_add(1, std::memory_order_relaxed);
+    auto first = next_queue.fetch_add(1, std::memory_order_relaxed);
+    for (size_t offset = 0; offset < queues.size(); ++offset)
+    {
+        if (queues[(first + offset) % queues.size()]->try_push(&job))
+        {
+            jobs_available.release();
+            return;
+        }
+    }
+    job.queued.fetch_sub(1, std::memory_order_relaxed);
+    job.tryRun();
+}
+
+void RenderThreadPool::wait(Job &job)
+{
+    // Only this job is run here, because another instance's job may take
+    // longer than this instance can wait.
+    if (job.tryRun())
+    {
+        return;
+    }
+    while (job.done.load(std::memory_order_acquire) == false)
+    {
+        std::this_thread::yield();
+    }
+}
+
+bool RenderThreadPool::runQueuedJob(size_t first)
+{
+    Job *job = nullptr;
+    for (size_t offset = 0; offset < queues.size(); ++offset)
+    {
+        if (queues[(first + offset) % queues.size()]->try_pop(job))
+        {
+            // The job is skipped if the thread waiting for it has run it.
+            job->tryRun();
+            // The last access to the job, which may then be destroyed.
+            job->queued.fetch_sub(1, std::memory_order_release);
+            return true;
+        }
+    }
+    return false;
+}
+
+void RenderThreadPool::setWorkgroup(const juce::AudioWorkgroup &workgroup_)
+{
+    std::lock_guard<std::mutex> lock(workgroup_mutex);
+    workgroup = workgroup_;
+    workgroup_generation.fetch_add(1, std::memory_order_release);
+}
+
+int RenderThreadPool::getThreadCount() const
+{
+    return int(workers.size());
+}
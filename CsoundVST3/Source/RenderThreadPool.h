@@ -0,0 +1,97 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <juce_audio_basics/juce_audio_basics.h>
+#include "csound_threaded.hpp"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <semaphore>
+#include <vector>
+
+/**
+ * A pool of real-time worker threads, shared by all CsoundVST3 instances in
+ * the process through a juce::SharedResourcePointer, and sized to the
+ * machine.
+ *
+ * An instance submits the rendering of one host block as a Job, and waits
+ * for it at the start of its next processBlock call. Hosts that call plugins
+ * one after another on one thread thus get all instances rendering in
+ * parallel, at the cost of one host block of latency.
+ *
+ * Each worker has its own queue. Submitted jobs are distributed across the
+ * queues, and a worker with an empty queue steals from the others. A thread
+ * that waits for a job runs that job itself if no worker has started it,
+ * so waiting never deadlocks, even if all workers are busy; it never runs
+ * another instance's job. Submitting and waiting neither lock nor allocate.
+ */
+class RenderThreadPool
+{
+public:
+    class Job
+    {
+    public:
+        Job() = default;
+        /**
+         * Waits until no queue still holds the job.
+         */
+        ~Job();
+        /**
+         * The work to do, set once before the job is first submitted.
+         */
+        std::function<void()> work;
+    private:
+        friend class RenderThreadPool;
+        /**
+         * Runs the work if no other thread has claimed it since the job was
+         * submitted.
+         */
+        bool tryRun();
+        std::atomic<bool> done {true};
+        std::atomic<bool> claimed {true};
+        /**
+         * The number of entries for the job in the queues. The thread that
+         * waits for a job may run it before a worker takes its entry, which
+         * the worker then skips.
+         */
+        std::atomic<int> queued {0};
+    };
+    RenderThreadPool();
+    ~RenderThreadPool();
+    /**
+     * Queues the job, which must not already be queued. If the queues are
+     * full, runs the job on the calling thread.
+     */
+    void submit(Job &job);
+    /**
+     * Returns when the job, if it was submitted, has finished, running it on
+     * the calling thread if no worker has started it.
+     */
+    void wait(Job &job);
+    /**
+     * The workers join this workgroup the next time that they wake.
+     */
+    void setWorkgroup(const juce::AudioWorkgroup &workgroup);
+    int getThreadCount() const;
+
+private:
+    class Worker;
+    /**
+     * Runs one queued job, looking first in the queue at index first;
+     * returns false if all queues are empty.
+     */
+    bool runQueuedJob(size_t first);
+    static constexpr size_t queue_capacity = 1024;
+    std::vector<std::unique_ptr<bounded_queue<Job *>>> queues;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next_queue {0};
+    std::counting_semaphore<> jobs_available {0};
+    std::atomic<bool> stopping {false};
+    std::mutex workgroup_mutex;
+    juce::AudioWorkgroup workgroup;
+    std::atomic<int> workgroup_generation {0};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RenderThreadPool)
+};
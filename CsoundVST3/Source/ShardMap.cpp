@@ -0,0 +1,47 @@
+#include "ShardMap.h"
+
+static const char *shards_begin_tag = "<CsoundVST3Shards>";
+static const char *shards_end_tag = "</CsoundVST3Shards>";
+
+bool ShardMap::parse(const juce::String &csd)
+{
+    shard_count = 1;
+    channel_shards.fill(0);
+    auto begin = csd.indexOf(shards_begin_tag);
+    if (begin == -1)
+    {
+        return false;
+    }
+    begin += juce::String(shards_begin_tag).length();
+    auto end = csd.indexOf(begin, shards_end_tag);
+    if (end == -1)
+    {
+        return false;
+    }
+    juce::StringArray lines;
+    lines.addLines(csd.substring(begin, end));
+    lines.trim();
+    lines.removeEmptyStrings();
+    shard_count = juce::jlimit(1, maximum_shards, lines.size());
+    for (int shard = 0; shard < shard_count; ++shard)
+    {
+        juce::StringArray words;
+        words.addTokens(lines[shard], " \t,;", "");
+        words.removeEmptyStrings();
+        for (auto &word : words)
+        {
+            auto first = word.upToFirstOccurrenceOf("-", false, false).getIntValue();
+            auto last = word.contains("-") ? word.fromFirstOccurrenceOf("-", false, false).getIntValue() : first;
+            for (auto channel = std::max(first, 1); channel <= std::min(last, 16); ++channel)
+            {
+                channel_shards[size_t(channel - 1)] = shard;
+            }
+        }
+    }
+    return true;
+}
+
+int ShardMap::getShardCount() const
+{
+    return shard_count;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+
+#include <array>
+
+/**
+ * Assigns MIDI channels to shards, that is, to separate Csound instances
+ * compiled from the same csd and rendered in parallel.
+ *
+ * A csd declares its shards in a <CsoundVST3Shards> element placed outside
+ * the <CsoundSynthesizer> element, one line per shard, each line listing
+ * the MIDI channels (1 to 16) or ranges of channels that the shard
+ * performs, for example:
+ *
+ *     <CsoundVST3Shards>
+ *     1-4
+ *     5-8
+ *     9-12 16
+ *     </CsoundVST3Shards>
+ *
+ * Channels not listed are performed by the first shard. Each shard is
+ * compiled with the orchestra and score macros CSOUNDVST3_SHARD (0 to K - 1)
+ * and CSOUNDVST3_SHARDS (K), so that the orchestra can, for example, run
+ * global effects or score-driven instruments in only one shard.
+ */
+class ShardMap
+{
+public:
+    static constexpr int maximum_shards = 16;
+    /**
+     * Parses the <CsoundVST3Shards> element of the csd. Returns false if
+     * the csd declares no shards, in which case there is one shard that
+     * performs all channels.
+     */
+    bool parse(const juce::String &csd);
+    int getShardCount() const;
+    /**
+     * Returns the shard that performs the MIDI channel, counting from 0.
+     */
+    int getShard(int channel) const
+    {
+        return channel_shards[size_t(channel & 15)];
+    }
+
+private:
+    int shard_count = 1;
+    std::array<int, 16> channel_shards {};
+};
@@ -43,8 +43,12 @@
 %}
 #endif
 #include "csound.hpp"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
+#include <cmath>
 #include <iomanip>
 #include <memory>
 #include <mutex>
@@ -53,6 +57,14 @@
 #include <string>
 #include <thread>
 #include <vector>
+#if defined(__linux__)
+#include <alloca.h>
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
 
 /**
  * A thread-safe queue, or first-in first-out (FIFO) queue, implemented using
@@ -100,6 +112,88 @@ public:
     }
 };
 
+/**
+ * A lock-free, bounded, multi-producer/multi-consumer queue of fixed
+ * capacity, implemented using only the standard C++11 library, after
+ * Dmitry Vyukov's bounded MPMC queue. Neither pushing nor popping ever
+ * blocks or allocates; try_push fails if the queue is full, and try_pop
+ * fails if it is empty. The capacity must be a power of 2. The Data should
+ * be a simple type, such as a pointer.
+ */
+template<typename Data>
+class bounded_queue
+{
+private:
+    struct cell
+    {
+        std::atomic<size_t> sequence;
+        Data data;
+    };
+    std::unique_ptr<cell[]> buffer_;
+    const size_t mask_;
+    alignas(64) std::atomic<size_t> enqueue_position_;
+    alignas(64) std::atomic<size_t> dequeue_position_;
+public:
+    explicit bounded_queue(size_t capacity)
+        : buffer_(new cell[capacity])
+        , mask_(capacity - 1)
+        , enqueue_position_(0)
+        , dequeue_position_(0)
+    {
+        for (size_t i = 0; i < capacity; ++i) {
+            buffer_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+    bool try_push(Data const& data)
+    {
+        cell *cell_ = nullptr;
+        size_t position = enqueue_position_.load(std::memory_order_relaxed);
+        while (true) {
+            cell_ = &buffer_[position & mask_];
+            size_t sequence = cell_->sequence.load(std::memory_order_acquire);
+            intptr_t difference = intptr_t(sequence) - intptr_t(position);
+            if (difference == 0) {
+                if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = enqueue_position_.load(std::memory_order_relaxed);
+            }
+        }
+        cell_->data = data;
+        cell_->sequence.store(position + 1, std::memory_order_release);
+        return true;
+    }
+    bool try_pop(Data& popped_value)
+    {
+        cell *cell_ = nullptr;
+        size_t position = dequeue_position_.load(std::memory_order_relaxed);
+        while (true) {
+            cell_ = &buffer_[position & mask_];
+            size_t sequence = cell_->sequence.load(std::memory_order_acquire);
+            intptr_t difference = intptr_t(sequence) - intptr_t(position + 1);
+            if (difference == 0) {
+                if (dequeue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                return false;
+            } else {
+                position = dequeue_position_.load(std::memory_order_relaxed);
+            }
+        }
+        popped_value = cell_->data;
+        cell_->sequence.store(position + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+};
+
 inline std::string csound_threaded_format_score_event(char opcode, const MYFLT *pfields, long pfield_count)
 {
     std::ostringstream stream;
@@ -111,6 +205,39 @@ inline std::string csound_threaded_format_score_event(char opcode, const MYFLT *
     return stream.str();
 }
 
+/**
+ * Dispatches a score event to Csound. On Csound 7, instrument, function
+ * table, and end events are sent as numbers using csoundEvent, which avoids
+ * formatting the pfields as text that Csound would then parse back into
+ * numbers. Events with other opcodes are still formatted as text.
+ */
+inline int csound_threaded_score_event(CSOUND *csound_, char opcode, const MYFLT *pfields, long pfield_count)
+{
+#if CSOUND_VERSION_MAJOR >= 7
+    int32_t type = -1;
+    switch (opcode) {
+    case 'i':
+        type = CS_INSTR_EVENT;
+        break;
+    case 'f':
+        type = CS_TABLE_EVENT;
+        break;
+    case 'e':
+        type = CS_END_EVENT;
+        break;
+    }
+    if (type != -1) {
+        csoundEvent(csound_, type, const_cast<MYFLT *>(pfields), static_cast<int32_t>(pfield_count), 0);
+        return 0;
+    }
+    const std::string text = csound_threaded_format_score_event(opcode, pfields, pfield_count);
+    csoundEventString(csound_, text.c_str(), 0);
+    return 0;
+#else
+    return csoundScoreEvent(csound_, opcode, pfields, pfield_count);
+#endif
+}
+
 /**
  * Abstract base class for Csound events to be enqueued
  * for performance.
@@ -141,13 +268,7 @@ struct CsoundScoreEvent : public CsoundEvent
     }
     virtual int operator ()(CSOUND *csound_)
     {
-#if CSOUND_VERSION_MAJOR >= 7
-        const std::string text = csound_threaded_format_score_event(opcode, pfields.data(), static_cast<long>(pfields.size()));
-        csoundEventString(csound_, text.c_str(), 0);
-        return 0;
-#else
-        return csoundScoreEvent(csound_, opcode, pfields.data(), static_cast<long>(pfields.size()));
-#endif
+        return csound_threaded_score_event(csound_, opcode, pfields.data(), static_cast<long>(pfields.size()));
     }
 };
 
@@ -173,6 +294,166 @@ struct CsoundTextEvent : public CsoundEvent
     }
 };
 
+/**
+ * One low-level score event in a batch of score events: an opcode and a
+ * span of raw pfields.
+ */
+struct CsoundScoreEventRecord
+{
+    char opcode;
+    const MYFLT *pfields;
+    long pfield_count;
+};
+
+/**
+ * A Csound event in the fixed-capacity pool of CsoundThreaded. Pooled events
+ * are recycled rather than deleted, and keep the capacity of their storage
+ * when they are recycled, so that the performance thread never allocates
+ * or frees memory to dispatch them. Up to inline_pfield_count pfields are
+ * stored inline in the event.
+ */
+struct CsoundPooledEvent
+{
+    enum Type
+    {
+        SCORE_EVENT,
+        TEXT_EVENT,
+        SCORE_EVENT_BATCH,
+    };
+    static constexpr long inline_pfield_count = 16;
+    Type type = SCORE_EVENT;
+    /**
+     * The performance frame at which a scheduled event is dispatched, or -1
+     * for an event that is dispatched at the next kperiod.
+     */
+    int64_t scheduled_frame = -1;
+    char opcode = 'i';
+    long pfield_count = 0;
+    MYFLT inline_pfields[inline_pfield_count];
+    std::vector<MYFLT> overflow_pfields;
+    std::string text;
+    std::vector<char> batch_opcodes;
+    std::vector<long> batch_pfield_counts;
+    std::vector<MYFLT> batch_pfields;
+    const MYFLT *pfields() const
+    {
+        return pfield_count <= inline_pfield_count ? inline_pfields : overflow_pfields.data();
+    }
+    MYFLT *pfields()
+    {
+        return pfield_count <= inline_pfield_count ? inline_pfields : overflow_pfields.data();
+    }
+    void set_score_event(char opcode_, const MYFLT *pfields_, long pfield_count_)
+    {
+        type = SCORE_EVENT;
+        scheduled_frame = -1;
+        opcode = opcode_;
+        pfield_count = pfield_count_;
+        if (pfield_count <= inline_pfield_count) {
+            std::copy(pfields_, pfields_ + pfield_count, inline_pfields);
+        } else {
+            overflow_pfields.assign(pfields_, pfields_ + pfield_count);
+        }
+    }
+    void set_text_event(const char *text_)
+    {
+        type = TEXT_EVENT;
+        scheduled_frame = -1;
+        text.assign(text_);
+    }
+    void set_score_event_batch(const CsoundScoreEventRecord *events, long event_count)
+    {
+        type = SCORE_EVENT_BATCH;
+        scheduled_frame = -1;
+        batch_opcodes.resize(event_count);
+        batch_pfield_counts.resize(event_count);
+        size_t total_pfield_count = 0;
+        for (long i = 0; i < event_count; ++i) {
+            batch_opcodes[i] = events[i].opcode;
+            batch_pfield_counts[i] = events[i].pfield_count;
+            total_pfield_count += events[i].pfield_count;
+        }
+        batch_pfields.resize(total_pfield_count);
+        MYFLT *destination = batch_pfields.data();
+        for (long i = 0; i < event_count; ++i) {
+            destination = std::copy(events[i].pfields, events[i].pfields + events[i].pfield_count, destination);
+        }
+    }
+    void set_score_event_batch(const char *opcodes, const long *pfield_counts, const MYFLT *pfields_, long event_count)
+    {
+        type = SCORE_EVENT_BATCH;
+        scheduled_frame = -1;
+        batch_opcodes.assign(opcodes, opcodes + event_count);
+        batch_pfield_counts.assign(pfield_counts, pfield_counts + event_count);
+        size_t total_pfield_count = 0;
+        for (long i = 0; i < event_count; ++i) {
+            total_pfield_count += pfield_counts[i];
+        }
+        batch_pfields.assign(pfields_, pfields_ + total_pfield_count);
+    }
+    /**
+     * Dispatches the event to Csound during performance.
+     */
+    int operator ()(CSOUND *csound_)
+    {
+        switch (type) {
+        case SCORE_EVENT:
+            return csound_threaded_score_event(csound_, opcode, pfields(), pfield_count);
+        case TEXT_EVENT:
+#if CSOUND_VERSION_MAJOR >= 7
+            csoundEventString(csound_, text.c_str(), 0);
+            return 0;
+#else
+            return csoundReadScore(csound_, text.c_str());
+#endif
+        case SCORE_EVENT_BATCH:
+        {
+            int result = 0;
+            const MYFLT *batch_event_pfields = batch_pfields.data();
+            for (size_t i = 0; i < batch_opcodes.size(); ++i) {
+                result |= csound_threaded_score_event(csound_, batch_opcodes[i], batch_event_pfields, batch_pfield_counts[i]);
+                batch_event_pfields += batch_pfield_counts[i];
+            }
+            return result;
+        }
+        }
+        return 0;
+    }
+};
+
+/**
+ * Real-time options for the CsoundThreaded performance thread, which the
+ * thread applies to itself when it starts. These are implemented only on
+ * Linux. If an option cannot be applied, e.g. because the process lacks
+ * CAP_SYS_NICE or a sufficient RLIMIT_RTPRIO or RLIMIT_MEMLOCK, a message
+ * is logged and the performance runs without it.
+ */
+struct CsoundPerformanceThreadOptions
+{
+    /**
+     * SCHED_OTHER (the default), SCHED_FIFO, or SCHED_RR.
+     */
+    int scheduling_policy = 0;
+    /**
+     * The real-time priority for SCHED_FIFO or SCHED_RR.
+     */
+    int priority = 0;
+    /**
+     * The CPU to which the thread is pinned, or -1 for any CPU.
+     */
+    int cpu = -1;
+    /**
+     * Locks all current and future pages of the process into memory.
+     */
+    bool lock_memory = false;
+    /**
+     * Touches this many bytes of the thread's stack, so that stack pages do
+     * not fault during performance. Clamped to the free space on the
+     * thread's stack, less a margin.
+     */
+    size_t prefault_stack_bytes = 0;
+};
+
 /**
  * This class provides a multi-threaded C++ interface to the "C" Csound API.
  * The interface is identical to the C++ interface of the Csound class in
@@ -180,6 +461,17 @@ struct CsoundTextEvent : public CsoundEvent
  * execution that is fed by a thread-safe FIFO of messages from ::ScoreEvent,
  * ::InputMessage, and ::ReadScore.
  *
+ * The FIFO is a lock-free queue of events taken from a pool of preallocated
+ * events, so producers never block the performance thread, and the
+ * performance thread neither allocates nor frees events. The pool grows,
+ * on the producer side, up to event_queue_capacity events; if it is
+ * exhausted, producers wait up to event_pool_wait for the performance
+ * thread to recycle events, and then drop the event, which is counted.
+ * The capacity is given to the constructor, and is rounded up to a power of
+ * two; the queues cost about 40 bytes per event of capacity, so the default
+ * is small, and an instance that must accept large bursts of events before
+ * they are dispatched should ask for more.
+ *
  * This is a header-file-only facility. The multi-threaded features of this
  * class are minimalistic, but seem sufficient for most purposes. There are
  * no external dependences apart from Csound and the standard C++ library.
@@ -190,16 +482,254 @@ protected:
     std::thread performance_thread;
     void (*kperiod_callback)(CSOUND *, void *);
     void *kperiod_callback_user_data;
-    concurrent_queue<CsoundEvent *> input_queue;
+    static constexpr size_t default_event_queue_capacity = 4096;
+    static constexpr size_t event_pool_block_size = 1024;
+    /**
+     * How long a producer waits for an event when the pool is exhausted:
+     * about one kperiod at common rates, in which the performance thread
+     * recycles the events that it dispatches.
+     */
+    static constexpr std::chrono::microseconds event_pool_wait {2000};
+    const size_t event_queue_capacity;
+    bounded_queue<CsoundPooledEvent *> input_queue;
+    bounded_queue<CsoundPooledEvent *> free_events;
+    std::vector<std::unique_ptr<CsoundPooledEvent[]>> event_pool;
+    /**
+     * Scheduled events that have been dequeued by the performance thread
+     * but are not yet due, as a min-heap on scheduled_frame. Its capacity
+     * is reserved for every event in the pool, so it never allocates.
+     */
+    std::vector<CsoundPooledEvent *> scheduled_events;
+    size_t event_pool_size = 0;
+    std::mutex event_pool_mutex;
+    std::atomic<int64_t> dropped_events {0};
+    CsoundPerformanceThreadOptions performance_thread_options;
     std::string output_type;
     std::string output_format;      
     std::string output_name;
 
     void ClearQueue()
     {
-        CsoundEvent *event = 0;
+        CsoundPooledEvent *event = nullptr;
         while (input_queue.try_pop(event)) {
-            delete event;
+            free_events.try_push(event);
+        }
+        for (auto scheduled_event : scheduled_events) {
+            free_events.try_push(scheduled_event);
+        }
+        scheduled_events.clear();
+    }
+
+    /**
+     * Returns the capacity rounded up to a power of two, as the queues
+     * require, and to at least one block of the pool.
+     */
+    static size_t RoundEventQueueCapacity(size_t capacity)
+    {
+        size_t rounded = event_pool_block_size;
+        while (rounded < capacity) {
+            rounded *= 2;
+        }
+        return rounded;
+    }
+
+    static bool IsScheduledLater(const CsoundPooledEvent *a, const CsoundPooledEvent *b)
+    {
+        return a->scheduled_frame > b->scheduled_frame;
+    }
+
+    /**
+     * Adds a block of events to the pool, unless the pool is already at
+     * capacity. Called only by producers.
+     */
+    bool GrowEventPool()
+    {
+        std::lock_guard<std::mutex> lock(event_pool_mutex);
+        if (event_pool_size >= event_queue_capacity) {
+            return false;
+        }
+        event_pool.emplace_back(new CsoundPooledEvent[event_pool_block_size]);
+        for (size_t i = 0; i < event_pool_block_size; ++i) {
+            free_events.try_push(&event_pool.back()[i]);
+        }
+        event_pool_size += event_pool_block_size;
+        return true;
+    }
+
+    /**
+     * Takes an event from the pool. If the pool is exhausted and the
+     * performance is running, waits up to event_pool_wait for the
+     * performance thread to recycle events; otherwise, or if none is
+     * recycled in time, counts the event as dropped and returns null.
+     */
+    CsoundPooledEvent *AcquireEvent()
+    {
+        CsoundPooledEvent *event = nullptr;
+        std::chrono::steady_clock::time_point deadline {};
+        while (true) {
+            if (free_events.try_pop(event)) {
+                return event;
+            }
+            if (GrowEventPool()) {
+                continue;
+            }
+            if (keep_running == false) {
+                Message("CsoundThreaded: the event pool is exhausted.\n");
+                dropped_events++;
+                return nullptr;
+            }
+            auto now = std::chrono::steady_clock::now();
+            if (deadline == std::chrono::steady_clock::time_point {}) {
+                deadline = now + event_pool_wait;
+            } else if (now >= deadline) {
+                dropped_events++;
+                return nullptr;
+            }
+            std::this_thread::yield();
+        }
+    }
+
+#if defined(__linux__)
+    /**
+     * The stack that is left untouched below the prefaulted bytes, for the
+     * frames of the calls that the performance thread makes from here.
+     */
+    static constexpr size_t prefault_stack_margin = 65536;
+
+    /**
+     * Returns the number of bytes of the calling thread's stack below the
+     * caller's frame, less prefault_stack_margin, or 0 if that cannot be
+     * found.
+     */
+    static size_t __attribute__((noinline)) GetFreeStackBytes()
+    {
+        pthread_attr_t attributes;
+        if (pthread_getattr_np(pthread_self(), &attributes) != 0) {
+            return 0;
+        }
+        void *stack_address = nullptr;
+        size_t stack_size = 0;
+        int result = pthread_attr_getstack(&attributes, &stack_address, &stack_size);
+        pthread_attr_destroy(&attributes);
+        if (result != 0) {
+            return 0;
+        }
+        // The stack grows down from stack_address + stack_size.
+        volatile unsigned char marker = 0;
+        const uintptr_t frame = reinterpret_cast<uintptr_t>(&marker);
+        const uintptr_t bottom = reinterpret_cast<uintptr_t>(stack_address);
+        if (frame < bottom + prefault_stack_margin || frame > bottom + stack_size) {
+            return 0;
+        }
+        return size_t(frame - bottom) - prefault_stack_margin;
+    }
+
+    static void __attribute__((noinline)) PrefaultStack(size_t bytes)
+    {
+        volatile unsigned char *stack = static_cast<volatile unsigned char *>(alloca(bytes));
+        for (size_t i = 0; i < bytes; i += 4096) {
+            stack[i] = 0;
+        }
+    }
+#endif
+
+    /**
+     * Applies the performance thread options to the calling thread, and
+     * logs the result of each. Called by the performance thread routines.
+     */
+    void ApplyPerformanceThreadOptions()
+    {
+        const CsoundPerformanceThreadOptions &options = performance_thread_options;
+#if defined(__linux__)
+        if (options.lock_memory) {
+            if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+                Message("CsoundThreaded: locked memory.\n");
+            } else {
+                Message("CsoundThreaded: could not lock memory: %s.\n", std::strerror(errno));
+            }
+        }
+        if (options.prefault_stack_bytes > 0) {
+            const size_t bytes = std::min(options.prefault_stack_bytes, GetFreeStackBytes());
+            if (bytes < options.prefault_stack_bytes) {
+                Message("CsoundThreaded: only %zu of the %zu bytes of stack to prefault are free.\n", bytes, options.prefault_stack_bytes);
+            }
+            if (bytes > 0) {
+                PrefaultStack(bytes);
+                Message("CsoundThreaded: prefaulted %zu bytes of stack.\n", bytes);
+            }
+        }
+        if (options.cpu >= 0) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(options.cpu, &cpu_set);
+            int result = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+            if (result == 0) {
+                Message("CsoundThreaded: pinned the performance thread to CPU %d.\n", options.cpu);
+            } else {
+                Message("CsoundThreaded: could not pin the performance thread to CPU %d: %s.\n", options.cpu, std::strerror(result));
+            }
+        }
+        if (options.scheduling_policy == SCHED_FIFO || options.scheduling_policy == SCHED_RR) {
+            sched_param parameters{};
+            parameters.sched_priority = std::min(std::max(options.priority, sched_get_priority_min(options.scheduling_policy)), sched_get_priority_max(options.scheduling_policy));
+            const char *policy_name = options.scheduling_policy == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR";
+            int result = pthread_setschedparam(pthread_self(), options.scheduling_policy, &parameters);
+            if (result == 0) {
+                Message("CsoundThreaded: the performance thread is %s at priority %d.\n", policy_name, parameters.sched_priority);
+            } else {
+                Message("CsoundThreaded: could not set %s at priority %d, using the default scheduling: %s.\n", policy_name, parameters.sched_priority, std::strerror(result));
+            }
+        }
+#else
+        if (options.scheduling_policy != 0 || options.cpu >= 0 || options.lock_memory || options.prefault_stack_bytes > 0) {
+            Message("CsoundThreaded: performance thread options are not supported on this platform.\n");
+        }
+#endif
+    }
+
+    /**
+     * Dispatches and recycles all pending events. Called only by the
+     * performance thread.
+     */
+    void DispatchEvents()
+    {
+        CsoundPooledEvent *event = nullptr;
+        while (input_queue.try_pop(event)) {
+            if (event->scheduled_frame >= 0) {
+                scheduled_events.push_back(event);
+                std::push_heap(scheduled_events.begin(), scheduled_events.end(), IsScheduledLater);
+                continue;
+            }
+            (*event)(csound);
+            free_events.try_push(event);
+        }
+        DispatchScheduledEvents();
+    }
+
+    /**
+     * Dispatches the scheduled events that are due in the kperiod about to
+     * be performed, adding each event's offset from the start of the
+     * kperiod, in seconds, to its p2. Events that are late are dispatched
+     * with no offset.
+     */
+    void DispatchScheduledEvents()
+    {
+        if (scheduled_events.empty()) {
+            return;
+        }
+        const int64_t kperiod_begin = csoundGetCurrentTimeSamples(csound);
+        const int64_t kperiod_end = kperiod_begin + int64_t(csoundGetKsmps(csound));
+        const double seconds_per_frame = 1. / double(csoundGetSr(csound));
+        while (!scheduled_events.empty() && scheduled_events.front()->scheduled_frame < kperiod_end) {
+            std::pop_heap(scheduled_events.begin(), scheduled_events.end(), IsScheduledLater);
+            CsoundPooledEvent *event = scheduled_events.back();
+            scheduled_events.pop_back();
+            const int64_t offset = std::max(event->scheduled_frame - kperiod_begin, int64_t(0));
+            if (event->pfield_count > 1) {
+                event->pfields()[1] += MYFLT(offset * seconds_per_frame);
+            }
+            (*event)(csound);
+            free_events.try_push(event);
         }
     }
 
@@ -212,37 +742,50 @@ protected:
 
     int ScoreEventNow(char opcode, const MYFLT *pfields, long pfield_count)
     {
-        const std::string text = csound_threaded_format_score_event(opcode, pfields, pfield_count);
-        csoundEventString(csound, text.c_str(), 0);
-        return 0;
+        return csound_threaded_score_event(csound, opcode, pfields, pfield_count);
     }
 #endif
 
 public:
     std::atomic<bool> keep_running;
 
-    CsoundThreaded()
+    explicit CsoundThreaded(size_t event_queue_capacity_ = default_event_queue_capacity)
         : Csound()
         , kperiod_callback(nullptr)
         , kperiod_callback_user_data(nullptr)
+        , event_queue_capacity(RoundEventQueueCapacity(event_queue_capacity_))
+        , input_queue(event_queue_capacity)
+        , free_events(event_queue_capacity)
         , keep_running(false)
     {
+        scheduled_events.reserve(event_queue_capacity);
+        GrowEventPool();
     }
 
-    CsoundThreaded(CSOUND *csound_)
+    CsoundThreaded(CSOUND *csound_, size_t event_queue_capacity_ = default_event_queue_capacity)
         : Csound(csound_)
         , kperiod_callback(nullptr)
         , kperiod_callback_user_data(nullptr)
+        , event_queue_capacity(RoundEventQueueCapacity(event_queue_capacity_))
+        , input_queue(event_queue_capacity)
+        , free_events(event_queue_capacity)
         , keep_running(false)
     {
+        scheduled_events.reserve(event_queue_capacity);
+        GrowEventPool();
     }
 
-    CsoundThreaded(void *host_data)
+    CsoundThreaded(void *host_data, size_t event_queue_capacity_ = default_event_queue_capacity)
         : Csound(host_data)
         , kperiod_callback(nullptr)
         , kperiod_callback_user_data(nullptr)
+        , event_queue_capacity(RoundEventQueueCapacity(event_queue_capacity_))
+        , input_queue(event_queue_capacity)
+        , free_events(event_queue_capacity)
         , keep_running(false)
     {
+        scheduled_events.reserve(event_queue_capacity);
+        GrowEventPool();
     }
 
     virtual ~CsoundThreaded()
@@ -452,6 +995,21 @@ public:
 #endif
     }
 
+    /**
+     * Sets the real-time scheduling policy, priority, CPU affinity, memory
+     * locking, and stack prefaulting of the performance thread. Takes
+     * effect when the performance thread is next started.
+     */
+    virtual void SetPerformanceThreadOptions(const CsoundPerformanceThreadOptions &options)
+    {
+        performance_thread_options = options;
+    }
+
+    virtual CsoundPerformanceThreadOptions GetPerformanceThreadOptions() const
+    {
+        return performance_thread_options;
+    }
+
     virtual void SetKperiodCallback(void (*kperiod_callback_)(CSOUND *, void *), void *kperiod_callback_user_data_)
     {
         kperiod_callback = kperiod_callback_;
@@ -461,17 +1019,14 @@ public:
     virtual int PerformRoutine()
     {
         Message("Began CsoundThreaded::PerformRoutine()...\n");
+        ApplyPerformanceThreadOptions();
         keep_running = true;
         int result = 0;
         while (true) {
             if (keep_running == false) {
                 break;
             }
-            CsoundEvent *event = 0;
-            while (input_queue.try_pop(event)) {
-                (*event)(csound);
-                delete event;
-            }
+            DispatchEvents();
             if (kperiod_callback != nullptr) {
                 kperiod_callback(csound, kperiod_callback_user_data);
             }
@@ -491,17 +1046,14 @@ public:
     virtual int PerformAndResetRoutine()
     {
         Message("Began CsoundThreaded::PerformAndResetRoutine()...\n");
+        ApplyPerformanceThreadOptions();
         keep_running = true;
         int result = 0;
         while (true) {
             if (keep_running == false) {
                 break;
             }
-            CsoundEvent *event = 0;
-            while (input_queue.try_pop(event)) {
-                (*event)(csound);
-                delete event;
-            }
+            DispatchEvents();
             if (kperiod_callback != nullptr) {
                 kperiod_callback(csound, kperiod_callback_user_data);
             }
@@ -550,10 +1102,78 @@ public:
      */
     virtual int ScoreEvent(char opcode, const MYFLT *pfields, long pfield_count)
     {
-        int result = 0;
-        CsoundScoreEvent *event = new CsoundScoreEvent(opcode, pfields, pfield_count);
-        input_queue.push(event);
-        return result;
+        CsoundPooledEvent *event = AcquireEvent();
+        if (event == nullptr) {
+            return -1;
+        }
+        event->set_score_event(opcode, pfields, pfield_count);
+        input_queue.try_push(event);
+        return 0;
+    }
+
+    /**
+     * Enqueues a low-level score event with raw pfields for dispatch from
+     * the performance thread routine in the kperiod that contains the
+     * absolute performance frame, rather than at the next kperiod. The
+     * event's offset within that kperiod, in seconds, is added to its p2;
+     * this offset is honored exactly only if Csound runs with
+     * --sample-accurate. Events scheduled for past frames are dispatched at
+     * the next kperiod.
+     */
+    virtual int ScheduleScoreEventAtFrame(int64_t frame, char opcode, const MYFLT *pfields, long pfield_count)
+    {
+        CsoundPooledEvent *event = AcquireEvent();
+        if (event == nullptr) {
+            return -1;
+        }
+        event->set_score_event(opcode, pfields, pfield_count);
+        event->scheduled_frame = std::max(frame, int64_t(0));
+        input_queue.try_push(event);
+        return 0;
+    }
+
+    /**
+     * Like ScheduleScoreEventAtFrame, but the absolute performance time is
+     * in seconds. Csound must already have been compiled, so that its
+     * sampling rate is known.
+     */
+    virtual int ScheduleScoreEvent(double time, char opcode, const MYFLT *pfields, long pfield_count)
+    {
+        const int64_t frame = int64_t(std::llround(time * double(csoundGetSr(csound))));
+        return ScheduleScoreEventAtFrame(frame, opcode, pfields, pfield_count);
+    }
+
+    /**
+     * Enqueues a batch of low-level score events, given as an array of
+     * records, as one unit for dispatch together, in order, from the
+     * performance thread routine at the next kperiod. The pfields are
+     * copied once, into storage that is reused.
+     */
+    virtual int ScoreEventBatch(const CsoundScoreEventRecord *events, long event_count)
+    {
+        CsoundPooledEvent *event = AcquireEvent();
+        if (event == nullptr) {
+            return -1;
+        }
+        event->set_score_event_batch(events, event_count);
+        input_queue.try_push(event);
+        return 0;
+    }
+
+    /**
+     * Like ScoreEventBatch, but the batch is given as arrays: event i has
+     * opcodes[i] and pfield_counts[i] pfields, which follow those of event
+     * i - 1 in pfields.
+     */
+    virtual int ScoreEventBatch(const char *opcodes, const long *pfield_counts, const MYFLT *pfields, long event_count)
+    {
+        CsoundPooledEvent *event = AcquireEvent();
+        if (event == nullptr) {
+            return -1;
+        }
+        event->set_score_event_batch(opcodes, pfield_counts, pfields, event_count);
+        input_queue.try_push(event);
+        return 0;
     }
 
     /**
@@ -562,8 +1182,12 @@ public:
      */
     virtual void InputMessage(const char *message)
     {
-        CsoundTextEvent *event = new CsoundTextEvent(message);
-        input_queue.push(event);
+        CsoundPooledEvent *event = AcquireEvent();
+        if (event == nullptr) {
+            return;
+        }
+        event->set_text_event(message);
+        input_queue.try_push(event);
     }
 
     /**
@@ -572,10 +1196,13 @@ public:
      */
     virtual int ReadScore(const char *score)
     {
-        int result = 0;
-        CsoundTextEvent *event = new CsoundTextEvent(score);
-        input_queue.push(event);
-        return result;
+        CsoundPooledEvent *event = AcquireEvent();
+        if (event == nullptr) {
+            return -1;
+        }
+        event->set_text_event(score);
+        input_queue.try_push(event);
+        return 0;
     }
 
     /**
@@ -613,4 +1240,13 @@ public:
     {
        return keep_running;
     }
+
+    /**
+     * Returns the number of events that were dropped because the event pool
+     * was exhausted.
+     */
+    int64_t GetDroppedEventCount() const
+    {
+        return dropped_events;
+    }
 };
@@ -0,0 +1,42 @@
+#pragma once
+
+/**
+ * Helpers shared by the tests and CsoundVST3_Bench, which drive
+ * CsoundVST3AudioProcessor without a host or an editor.
+ */
+#include "PluginProcessor.h"
+#include <cstdio>
+
+/**
+ * Loads the csd into the processor, prepares it, and starts it playing. The
+ * caller sets the play head and any other options first.
+ */
+inline void startProcessor(CsoundVST3AudioProcessor &processor, const juce::String &csd, double sample_rate, int block_size, int inputs, int outputs)
+{
+    {
+        juce::ScopedLock lock(processor.csd_lock);
+        processor.csd = csd;
+    }
+    processor.setPlayConfigDetails(inputs, outputs, sample_rate, block_size);
+    processor.prepareToPlay(sample_rate, block_size);
+    // As the editor's Play button does, because prepareToPlay does not
+    // start playing in an unknown host.
+    processor.suspendProcessing(false);
+    processor.csoundIsPlaying = true;
+}
+
+/**
+ * Empties the processor's log ring, as the editor's timer does, and prints
+ * the messages to stderr if verbose.
+ */
+inline void drainLog(CsoundVST3AudioProcessor &processor, bool verbose)
+{
+    processor.flushLog();
+    processor.log_ring.read([verbose](const LogRing::Header &header, const char *message)
+    {
+        if (verbose)
+        {
+            std::fwrite(message, 1, header.length, stderr);
+        }
+    });
+}
@@ -0,0 +1,113 @@
+/**
+ * Checks that MIDI that wakes a hibernating CsoundVST3AudioProcessor is
+ * performed at once. Drives the processor without a host: renders silence
+ * until the instance hibernates, sleeps for a number of host blocks, then
+ * sends a note-on at the start of a block, and checks that Csound starts
+ * the note in the next kperiod, rather than after the time slept.
+ *
+ * Usage: hibernation_test [--verbose]
+ */
+#include "ProcessorHarness.h"
+#include <cstdio>
+
+static const char *test_csd = R"(<CsoundSynthesizer>
+<CsOptions>
+-m0 -+rtmidi=NULL -M0 -d
+</CsOptions>
+<CsInstruments>
+sr = 48000
+ksmps = 32
+nchnls = 2
+0dbfs = 1
+chnset -1, "note_on_kperiod"
+instr 1
+ikperiod timek
+chnset ikperiod, "note_on_kperiod"
+endin
+</CsInstruments>
+<CsScore>
+f 0 z
+</CsScore>
+</CsoundSynthesizer>
+)";
+
+/**
+ * A transport that is stopped, so that only MIDI wakes the instance.
+ */
+class StoppedPlayHead : public juce::AudioPlayHead
+{
+public:
+    juce::Optional<PositionInfo> getPosition() const override
+    {
+        PositionInfo position;
+        position.setIsPlaying(false);
+        return position;
+    }
+};
+
+static int fail(const char *message)
+{
+    std::fprintf(stderr, "FAILED: %s\n", message);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    juce::ScopedJuceInitialiser_GUI juce_initialiser;
+    juce::ArgumentList arguments(argc, argv);
+    auto verbose = arguments.containsOption("--verbose");
+    const double sample_rate = 48000;
+    const int block_size = 256;
+    const int ksmps = 32;
+    const int blocks_slept = 100;
+    CsoundVST3AudioProcessor processor;
+    processor.hibernation_tail_seconds = 0.05;
+    StoppedPlayHead play_head;
+    processor.setPlayHead(&play_head);
+    startProcessor(processor, test_csd, sample_rate, block_size, 2, 2);
+    drainLog(processor, verbose);
+    auto csound = processor.csound.getCsoundHandle();
+    juce::AudioBuffer<float> buffer(2, block_size);
+    juce::MidiBuffer midi;
+    auto process = [&]()
+    {
+        buffer.clear();
+        processor.processBlock(buffer, midi);
+        midi.clear();
+        drainLog(processor, verbose);
+    };
+    // Renders a second of silence, well over the tail.
+    for (int block = 0; block < int(sample_rate) / block_size; ++block)
+    {
+        process();
+    }
+    // While the instance hibernates, Csound's clock does not advance.
+    auto hibernation_frame = csoundGetCurrentTimeSamples(csound);
+    for (int block = 0; block < blocks_slept; ++block)
+    {
+        process();
+    }
+    if (csoundGetCurrentTimeSamples(csound) != hibernation_frame)
+    {
+        return fail("the instance did not hibernate.");
+    }
+    midi.addEvent(juce::MidiMessage::noteOn(1, 60, juce::uint8(100)), 0);
+    process();
+    int32_t error = 0;
+    auto note_on_kperiod = int64_t(csoundGetControlChannel(csound, "note_on_kperiod", &error));
+    processor.releaseResources();
+    drainLog(processor, verbose);
+    if (error != 0 || note_on_kperiod < 0)
+    {
+        return fail("Csound did not receive the note-on in the block that woke the instance.");
+    }
+    // timek counts the kperiods performed before the note's, or with it.
+    auto expected_kperiod = hibernation_frame / ksmps;
+    if (note_on_kperiod < expected_kperiod || note_on_kperiod > expected_kperiod + 1)
+    {
+        std::fprintf(stderr, "FAILED: the note-on was received in kperiod %lld, not %lld.\n", (long long)note_on_kperiod, (long long)expected_kperiod);
+        return 1;
+    }
+    std::printf("Passed: the note-on that woke the instance was received in kperiod %lld.\n", (long long)note_on_kperiod);
+    return 0;
+}
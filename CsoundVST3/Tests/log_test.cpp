@@ -0,0 +1,80 @@
+/**
+ * Checks that a Csound message longer than a log record reaches the log
+ * ring truncated, and that the log limiter reads only the formatted part
+ * of it. Configure with -DCSOUNDVST3_SANITIZE_ADDRESS=ON to have
+ * AddressSanitizer check that nothing reads past the formatting buffer.
+ *
+ * Usage: log_test [--verbose]
+ */
+#include "ProcessorHarness.h"
+#include <cstdio>
+#include <string>
+
+static const char *test_csd = R"(<CsoundSynthesizer>
+<CsOptions>
+-m0 -+rtmidi=NULL -M0 -d
+</CsOptions>
+<CsInstruments>
+sr = 48000
+ksmps = 32
+nchnls = 2
+0dbfs = 1
+</CsInstruments>
+<CsScore>
+f 0 z
+</CsScore>
+</CsoundSynthesizer>
+)";
+
+static int fail(const char *message)
+{
+    std::fprintf(stderr, "FAILED: %s\n", message);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    juce::ScopedJuceInitialiser_GUI juce_initialiser;
+    juce::ArgumentList arguments(argc, argv);
+    auto verbose = arguments.containsOption("--verbose");
+    CsoundVST3AudioProcessor processor;
+    startProcessor(processor, test_csd, 48000, 256, 2, 2);
+    drainLog(processor, verbose);
+    auto csound = processor.csound.getCsoundHandle();
+    // Four times the longest record, so that any read past the formatting
+    // buffer in the message callback, the limiter, or the ring is caught.
+    std::string message(4 * LogRing::maximum_text_bytes, 'x');
+    message += '\n';
+    auto truncated_count = processor.log_ring.getTruncatedCount();
+    auto repeated_count = processor.log_limiter.getRepeatedCount();
+    ::csoundMessage(csound, "%s", message.c_str());
+    // The same message again is counted as a repeat, not written.
+    ::csoundMessage(csound, "%s", message.c_str());
+    int records = 0;
+    processor.log_ring.read([&](const LogRing::Header &header, const char *text)
+    {
+        if (header.length == LogRing::maximum_text_bytes && (header.flags & LogRing::truncated_flag) != 0 &&
+            message.compare(0, header.length, text, header.length) == 0)
+        {
+            ++records;
+        }
+        else if (verbose)
+        {
+            std::fwrite(text, 1, header.length, stderr);
+        }
+    });
+    auto truncated = processor.log_ring.getTruncatedCount() - truncated_count;
+    auto repeated = processor.log_limiter.getRepeatedCount() - repeated_count;
+    processor.releaseResources();
+    drainLog(processor, verbose);
+    if (records != 1 || truncated != 1)
+    {
+        return fail("the long message was not written once, truncated to one record.");
+    }
+    if (repeated != 1)
+    {
+        return fail("the repeated long message was not counted as a repeat.");
+    }
+    std::printf("Passed: a %zu byte message was logged as a truncated %zu byte record.\n", message.size(), LogRing::maximum_text_bytes);
+    return 0;
+}